@@ -0,0 +1,168 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_BAR_BUILDER_H_
+#define TWAP_BAR_BUILDER_H_
+
+#include <cmath>
+#include <limits>
+
+// Summary of the max price over one interval of the time grid,
+// see BarBuilder.
+//
+struct Bar {
+	int begin_time;      // the bar covers [begin_time, begin_time + interval)
+	double twap;         // NAN if there was no price during the bar
+	double open;         // price at the start of the bar, or the first one in it
+	double high;
+	double low;
+	double close;        // price at the end of the bar (NAN if there were no orders)
+	double covered_time; // time with a price within the bar
+	long long event_count;
+};
+
+// Resamples the max price series into bars of a fixed time interval,
+// aligned at the multiples of it, in one pass: TWAP over the bar, the
+// open, high, low and close of the max price, the time with a price,
+// and the number of events in the bar.
+//
+// Same as in TWAP, each price lasts from its time until the time of
+// the next price, so a price which lasts over a bar boundary is split
+// between the bars, and the next bar opens with it. High and low are
+// of all the prices during the bar, including those which last no time.
+// NAN prices (no orders) are not covered, and not counted in OHLC.
+//
+// A bar is completed when an event after it arrives, so the bars with
+// a price and no events (e.g. in a quiet period) are also produced, and
+// the bars with neither are skipped. The last bar is only completed by
+// finish(), up to the time of the last event.
+//
+class BarBuilder {
+
+private:
+
+	int interval_;
+	bool started_;
+	int last_time_;
+	double last_price_;
+	double price_time_; // price-time integral within the bar
+	Bar bar_;
+
+	// start of the bar containing the time
+	int bar_begin(const int time) const {
+		int begin = time - time % interval_;
+		if (time % interval_ < 0) {
+			begin -= interval_;
+		}
+		return begin;
+	}
+
+	void add_price(const double price) {
+		if (std::isnan(price)) {
+			return;
+		}
+		if (std::isnan(bar_.open)) {
+			bar_.open = price;
+			bar_.high = price;
+			bar_.low = price;
+		} else if (price > bar_.high) {
+			bar_.high = price;
+		} else if (price < bar_.low) {
+			bar_.low = price;
+		}
+	}
+
+	// the last price lasts until the time within the bar
+	void add_time(const int time) {
+		if (!std::isnan(last_price_) && time > last_time_) {
+			price_time_ += last_price_ * (time - last_time_);
+			bar_.covered_time += time - last_time_;
+		}
+		last_time_ = time;
+	}
+
+	void start_bar(const int begin_time) {
+		const double nan = std::numeric_limits<double>::quiet_NaN();
+		price_time_ = 0;
+		bar_.begin_time = begin_time;
+		bar_.twap = nan;
+		bar_.open = nan;
+		bar_.high = nan;
+		bar_.low = nan;
+		bar_.close = last_price_;
+		bar_.covered_time = 0;
+		bar_.event_count = 0;
+		add_price(last_price_);
+	}
+
+	template <typename Output>
+	void complete_bar(Output &output) {
+		if (bar_.covered_time > 0) {
+			bar_.twap = price_time_ / bar_.covered_time;
+		}
+		output(bar_);
+	}
+
+public:
+
+	// Interval is the length of the bars in time units (milliseconds).
+	explicit BarBuilder(const int interval) {
+		interval_ = interval > 0 ? interval : 1;
+		started_ = false;
+		last_time_ = 0;
+		last_price_ = std::numeric_limits<double>::quiet_NaN();
+		start_bar(0);
+	}
+
+	int interval() const {
+		return interval_;
+	}
+
+	// Adds the event with the max price after it, and passes the bars
+	// completed before its time to output(const Bar &). Same as in
+	// TWAP::next_price(), the price of an event whose time goes back is
+	// dropped, and the last price carries on, but the event is counted
+	// in the current bar. Without a last price, the time going back is
+	// taken as the last time, since the earlier bars are completed.
+	template <typename Output>
+	void next(int time, const double price, Output &output) {
+		if (!started_) {
+			started_ = true;
+			last_time_ = time;
+			start_bar(bar_begin(time));
+		} else if (time < last_time_) {
+			if (!std::isnan(last_price_)) {
+				bar_.event_count++; // time is not increasing, dropped as by TWAP
+				return;
+			}
+			time = last_time_;
+		}
+		while (time >= bar_.begin_time + interval_) {
+			const int end_time = bar_.begin_time + interval_;
+			add_time(end_time);
+			complete_bar(output);
+			if (std::isnan(last_price_)) {
+				// no price until the time, so no bars in between
+				last_time_ = time;
+				start_bar(bar_begin(time));
+			} else {
+				start_bar(end_time);
+			}
+		}
+		add_time(time);
+		last_price_ = price;
+		bar_.close = price;
+		bar_.event_count++;
+		add_price(price);
+	}
+
+	// Completes the last bar, if there were any events.
+	template <typename Output>
+	void finish(Output &output) {
+		if (started_) {
+			complete_bar(output);
+			started_ = false;
+		}
+	}
+};
+
+#endif  // TWAP_BAR_BUILDER_H_
@@ -0,0 +1,23 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_BINARY_IO_H_
+#define TWAP_BINARY_IO_H_
+
+#include <istream>
+#include <ostream>
+
+// Writes the value to the stream in the native byte order.
+//
+template <typename T>
+inline void write_value(std::ostream &out, const T value) {
+	out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+// Reads the value written with write_value(), returns false on failure.
+//
+template <typename T>
+inline bool read_value(std::istream &in, T &value) {
+	return (bool)in.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+#endif  // TWAP_BINARY_IO_H_
@@ -0,0 +1,285 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_CONCURRENT_ORDER_BOOK_H_
+#define TWAP_CONCURRENT_ORDER_BOOK_H_
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "order_book.h"
+
+// Order book which several threads (e.g. one per feed line) can update
+// at the same time, instead of serializing them behind a mutex around
+// OrderBook. It has the same contents, and at any moment when no update
+// is in progress, the same max price and depth as OrderBook.
+//
+// 1) Prices must be on a fixed tick grid within a range given upfront,
+//    i.e. price = tick / ticks_per_unit for an integer tick (e.g. 100
+//    ticks per unit for cents), which makes each price point a slot
+//    in an array. Since the division of two integers is rounded the same
+//    way as the price read from the decimal text, the prices are exactly
+//    the same as in OrderBook. Orders with other prices are rejected.
+//
+// 2) The order index (order->tick) is split into shards by order id,
+//    each with its own spin lock. When each producer thread gets its
+//    own subset of order ids (e.g. by id modulo the number of threads),
+//    the locks are never contended, and they only ensure ordering if
+//    the same order id is ever seen by two producers.
+//
+// 3) The number of orders at each price point is an atomic counter.
+//
+// 4) The price points with orders are marked in a two-level bitmap, so
+//    that max price is found with two "count leading zeros" lookups,
+//    without any locks. The thread which makes a count non-zero or zero
+//    updates its bit, and then checks the count again, and fixes the bit
+//    if another thread has changed it meanwhile (so the bits are correct
+//    whenever no update is in progress). The readers also skip the bits
+//    whose counts are already zero, so while the updates are in progress,
+//    max price is the price of some level with orders at that time.
+//
+class ConcurrentOrderBook {
+
+private:
+
+	struct Shard {
+		std::atomic_flag lock;
+		std::unordered_map<int, int> order_levels;
+		char padding[64]; // to keep the shards on separate cache lines
+	};
+
+	int ticks_per_unit_;
+	long long min_tick_;
+	size_t level_count_;
+	size_t shard_count_;
+
+	Shard *shards_;
+	std::atomic<int> *level_counts_;
+	std::atomic<uint64_t> *level_bits_;   // bit for each level with orders
+	std::atomic<uint64_t> *summary_bits_; // bit for each non-zero word of level_bits_
+	size_t word_count_;
+	size_t summary_word_count_;
+
+	ConcurrentOrderBook(const ConcurrentOrderBook &);
+	ConcurrentOrderBook &operator=(const ConcurrentOrderBook &);
+
+	static int highest_bit(const uint64_t word) {
+		return 63 - __builtin_clzll(word);
+	}
+
+	Shard &shard(const int order_id) const {
+		return shards_[static_cast<unsigned int>(order_id) % shard_count_];
+	}
+
+	static void lock(Shard &shard) {
+		while (shard.lock.test_and_set(std::memory_order_acquire)) {
+			std::this_thread::yield();
+		}
+	}
+
+	static void unlock(Shard &shard) {
+		shard.lock.clear(std::memory_order_release);
+	}
+
+	// returns false if the price is not on the grid
+	bool find_level(const double price, size_t &level) const {
+		const double tick = std::floor(price * ticks_per_unit_ + 0.5);
+		if (!(tick >= min_tick_ && tick < min_tick_ + (double)level_count_)) {
+			return false;
+		}
+		level = static_cast<size_t>(tick - min_tick_);
+		return level_price(level) == price;
+	}
+
+	double level_price(const size_t level) const {
+		return static_cast<double>(min_tick_ + (long long)level) / ticks_per_unit_;
+	}
+
+	void sync_summary_bit(const size_t word) {
+		const uint64_t bit = 1ULL << (word % 64);
+		while (true) {
+			const bool marked = level_bits_[word].load() != 0;
+			if (marked) {
+				summary_bits_[word / 64].fetch_or(bit);
+			} else {
+				summary_bits_[word / 64].fetch_and(~bit);
+			}
+			if ((level_bits_[word].load() != 0) == marked) {
+				break;
+			}
+		}
+	}
+
+	// called after the count of the level becomes non-zero or zero
+	void sync_level_bit(const size_t level) {
+		const size_t word = level / 64;
+		const uint64_t bit = 1ULL << (level % 64);
+		while (true) {
+			const bool live = level_counts_[level].load() > 0;
+			if (live) {
+				level_bits_[word].fetch_or(bit);
+			} else {
+				level_bits_[word].fetch_and(~bit);
+			}
+			sync_summary_bit(word);
+			if ((level_counts_[level].load() > 0) == live) {
+				break;
+			}
+		}
+	}
+
+public:
+
+	// Covers the prices from min_price to max_price (rounded out to the
+	// grid) with ticks_per_unit price points per unit of price. Shard count
+	// is best a multiple of the number of producer threads.
+	ConcurrentOrderBook(const int ticks_per_unit, const double min_price,
+			const double max_price, const size_t shard_count) {
+		ticks_per_unit_ = ticks_per_unit > 0 ? ticks_per_unit : 1;
+		min_tick_ = (long long)std::floor(min_price * ticks_per_unit_);
+		const long long max_tick = (long long)std::ceil(max_price * ticks_per_unit_);
+		level_count_ = max_tick >= min_tick_ ? (size_t)(max_tick - min_tick_ + 1) : 1;
+		shard_count_ = shard_count > 0 ? shard_count : 1;
+
+		shards_ = new Shard[shard_count_];
+		for (size_t i = 0; i < shard_count_; i++) {
+			shards_[i].lock.clear();
+		}
+		level_counts_ = new std::atomic<int>[level_count_];
+		for (size_t i = 0; i < level_count_; i++) {
+			level_counts_[i].store(0);
+		}
+		word_count_ = (level_count_ + 63) / 64;
+		level_bits_ = new std::atomic<uint64_t>[word_count_];
+		for (size_t i = 0; i < word_count_; i++) {
+			level_bits_[i].store(0);
+		}
+		summary_word_count_ = (word_count_ + 63) / 64;
+		summary_bits_ = new std::atomic<uint64_t>[summary_word_count_];
+		for (size_t i = 0; i < summary_word_count_; i++) {
+			summary_bits_[i].store(0);
+		}
+	}
+
+	~ConcurrentOrderBook() {
+		delete[] shards_;
+		delete[] level_counts_;
+		delete[] level_bits_;
+		delete[] summary_bits_;
+	}
+
+	size_t level_count() const {
+		return level_count_;
+	}
+
+	// Returns true if the price can be stored in this order book.
+	bool covers(const double price) const {
+		size_t level;
+		return find_level(price, level);
+	}
+
+	// Reserves space for this many orders in each shard.
+	void reserve(const size_t orders_per_shard) {
+		for (size_t i = 0; i < shard_count_; i++) {
+			lock(shards_[i]);
+			shards_[i].order_levels.reserve(orders_per_shard);
+			unlock(shards_[i]);
+		}
+	}
+
+	// Returns true if the order was added, and false if an order with
+	// this id already exists, or the price is not covered.
+	// Can be called from any thread.
+	bool insert_order(const int order_id, const double price) {
+		size_t level;
+		if (!find_level(price, level)) {
+			return false;
+		}
+		Shard &order_shard = shard(order_id);
+		lock(order_shard);
+		const bool inserted = order_shard.order_levels.insert(
+			std::make_pair(order_id, static_cast<int>(level))).second;
+		const int old_count = inserted ? level_counts_[level].fetch_add(1) : -1;
+		unlock(order_shard);
+		if (old_count == 0) {
+			sync_level_bit(level);
+		}
+		return inserted;
+	}
+
+	// Returns true if the order was removed, and false if there
+	// was no order with this id. Can be called from any thread.
+	bool erase_order(const int order_id) {
+		Shard &order_shard = shard(order_id);
+		lock(order_shard);
+		const std::unordered_map<int, int>::iterator it = order_shard.order_levels.find(order_id);
+		if (it == order_shard.order_levels.end()) {
+			unlock(order_shard);
+			return false;
+		}
+		const size_t level = it->second;
+		order_shard.order_levels.erase(it);
+		const int old_count = level_counts_[level].fetch_sub(1);
+		unlock(order_shard);
+		if (old_count == 1) {
+			sync_level_bit(level);
+		}
+		return true;
+	}
+
+	// Can be called from any thread, while the updates are in progress.
+	double max_price() const {
+		PriceLevel level;
+		if (copy_depth(&level, 1) == 0) {
+			return std::numeric_limits<double>::quiet_NaN();
+		}
+		return level.price;
+	}
+
+	// Copies up to max_levels highest price levels into the array,
+	// highest first, and returns the number of levels copied, same
+	// as OrderBook::copy_depth(). Can be called from any thread,
+	// but only gives a consistent ladder when there are no updates.
+	size_t copy_depth(PriceLevel *levels, const size_t max_levels) const {
+		size_t count = 0;
+		for (size_t s = summary_word_count_; s-- > 0 && count < max_levels;) {
+			uint64_t summary = summary_bits_[s].load();
+			while (summary != 0 && count < max_levels) {
+				const int summary_bit = highest_bit(summary);
+				summary &= ~(1ULL << summary_bit);
+				const size_t word = s * 64 + summary_bit;
+				uint64_t bits = level_bits_[word].load();
+				while (bits != 0 && count < max_levels) {
+					const int bit = highest_bit(bits);
+					bits &= ~(1ULL << bit);
+					const size_t level = word * 64 + bit;
+					const int level_count = level_counts_[level].load();
+					if (level_count > 0) {
+						levels[count].price = level_price(level);
+						levels[count].count = level_count;
+						count++;
+					}
+				}
+			}
+		}
+		return count;
+	}
+
+	// Number of orders in the book, only exact when there are no updates.
+	size_t live_orders() const {
+		size_t result = 0;
+		for (size_t i = 0; i < shard_count_; i++) {
+			lock(shards_[i]);
+			result += shards_[i].order_levels.size();
+			unlock(shards_[i]);
+		}
+		return result;
+	}
+};
+
+#endif  // TWAP_CONCURRENT_ORDER_BOOK_H_
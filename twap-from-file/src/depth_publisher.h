@@ -0,0 +1,228 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_DEPTH_PUBLISHER_H_
+#define TWAP_DEPTH_PUBLISHER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "order_book.h"
+
+// Immutable copy of the top price levels of the order book, highest
+// price first, see DepthPublisher.
+//
+struct DepthSnapshot {
+	int time;
+	uint64_t sequence; // number of the publication
+	size_t level_count;
+	std::vector<PriceLevel> levels; // only the first level_count are valid
+
+	// epoch when it was replaced, only used by the writer
+	uint64_t retire_epoch;
+};
+
+// Publishes depth snapshots of the order book from the updating thread
+// to any number of reader threads, which never block the writer, and
+// see a consistent ladder for as long as they hold it.
+//
+// The current snapshot is swapped with a single atomic pointer store
+// (read-copy-update), and the replaced snapshots are reclaimed with
+// epoch-based reclamation: each reader announces the global epoch in
+// its slot before loading the pointer, and a snapshot retired at some
+// epoch is only reused when no reader has announced that epoch or an
+// earlier one. The reclaimed snapshots are reused by the writer, so
+// after warm-up publishing doesn't allocate memory (a few snapshots are
+// allocated upfront, more only while the readers hold the old ones).
+//
+// Up to kMaxReaders readers can hold the snapshots at the same time,
+// any more wait for a slot.
+//
+class DepthPublisher {
+
+public:
+
+	static const size_t kMaxReaders = 64;
+
+private:
+
+	// enough when the readers don't hold the snapshots for long
+	static const size_t kPreallocatedSnapshots = 4;
+
+	// each on its own cache line, as it is written by its reader
+	struct ReaderSlot {
+		std::atomic<uint64_t> epoch; // 0 when the slot is free
+		char padding[64 - sizeof(std::atomic<uint64_t>)];
+	};
+
+	size_t depth_;
+	std::atomic<DepthSnapshot *> current_;
+	std::atomic<uint64_t> epoch_;
+	uint64_t sequence_;
+	mutable ReaderSlot slots_[kMaxReaders];
+
+	// only used by the writer
+	std::vector<DepthSnapshot *> retired_;
+	std::vector<DepthSnapshot *> free_;
+
+	DepthSnapshot *allocate_snapshot() const {
+		DepthSnapshot *snapshot = new DepthSnapshot();
+		try {
+			snapshot->levels.resize(depth_);
+		} catch (...) {
+			delete snapshot;
+			throw;
+		}
+		return snapshot;
+	}
+
+	DepthSnapshot *new_snapshot() {
+		if (free_.empty()) {
+			return allocate_snapshot();
+		}
+		DepthSnapshot *snapshot = free_.back();
+		free_.pop_back();
+		return snapshot;
+	}
+
+	// grows the capacity geometrically, as push_back() would
+	static void reserve(std::vector<DepthSnapshot *> &snapshots, const size_t size) {
+		if (snapshots.capacity() < size) {
+			snapshots.reserve(std::max(size, 2 * snapshots.capacity()));
+		}
+	}
+
+	// doesn't allocate, see publish()
+	void reclaim() {
+		uint64_t min_epoch = UINT64_MAX;
+		for (size_t i = 0; i < kMaxReaders; i++) {
+			const uint64_t epoch = slots_[i].epoch.load(std::memory_order_seq_cst);
+			if (epoch != 0 && epoch < min_epoch) {
+				min_epoch = epoch;
+			}
+		}
+		size_t kept = 0;
+		for (size_t i = 0; i < retired_.size(); i++) {
+			if (retired_[i]->retire_epoch < min_epoch) {
+				free_.push_back(retired_[i]);
+			} else {
+				retired_[kept++] = retired_[i];
+			}
+		}
+		retired_.resize(kept);
+	}
+
+	DepthPublisher(const DepthPublisher &);
+	DepthPublisher &operator=(const DepthPublisher &);
+
+public:
+
+	// Holds the current snapshot for reading, until destroyed.
+	class ReadGuard {
+
+	private:
+
+		const DepthPublisher &publisher_;
+		ReaderSlot *slot_;
+		const DepthSnapshot *snapshot_;
+
+		ReadGuard(const ReadGuard &);
+		ReadGuard &operator=(const ReadGuard &);
+
+	public:
+
+		explicit ReadGuard(const DepthPublisher &publisher) : publisher_(publisher) {
+			slot_ = 0;
+			while (true) {
+				const uint64_t epoch = publisher_.epoch_.load(std::memory_order_seq_cst);
+				for (size_t i = 0; i < kMaxReaders; i++) {
+					uint64_t free_epoch = 0;
+					ReaderSlot &slot = publisher_.slots_[i];
+					if (slot.epoch.compare_exchange_strong(free_epoch, epoch, std::memory_order_seq_cst)) {
+						slot_ = &slot;
+						break;
+					}
+				}
+				if (slot_) {
+					break;
+				}
+				std::this_thread::yield(); // too many readers at the moment
+			}
+			snapshot_ = publisher_.current_.load(std::memory_order_seq_cst);
+		}
+
+		~ReadGuard() {
+			slot_->epoch.store(0, std::memory_order_release);
+		}
+
+		// Null if nothing has been published yet.
+		const DepthSnapshot *snapshot() const {
+			return snapshot_;
+		}
+	};
+
+	// Depth is the max number of price levels in a snapshot.
+	explicit DepthPublisher(const size_t depth) {
+		depth_ = depth;
+		current_.store(0);
+		epoch_.store(1);
+		sequence_ = 0;
+		for (size_t i = 0; i < kMaxReaders; i++) {
+			slots_[i].epoch.store(0);
+		}
+		retired_.reserve(kPreallocatedSnapshots);
+		free_.reserve(kPreallocatedSnapshots);
+		try {
+			for (size_t i = 0; i < kPreallocatedSnapshots; i++) {
+				free_.push_back(allocate_snapshot());
+			}
+		} catch (...) {
+			for (size_t i = 0; i < free_.size(); i++) {
+				delete free_[i];
+			}
+			throw;
+		}
+	}
+
+	// There must be no readers left.
+	~DepthPublisher() {
+		delete current_.load();
+		for (size_t i = 0; i < retired_.size(); i++) {
+			delete retired_[i];
+		}
+		for (size_t i = 0; i < free_.size(); i++) {
+			delete free_[i];
+		}
+	}
+
+	size_t depth() const {
+		return depth_;
+	}
+
+	// Copies the top levels of the order book into a new snapshot, and
+	// makes it current. Only one thread may publish. If memory can't be
+	// allocated, it throws before changing anything, and the previous
+	// snapshot stays current.
+	void publish(const int time, const OrderBook &order_book) {
+		// room for the old snapshot in the lists, so that nothing
+		// allocates once the new snapshot is taken
+		reserve(retired_, retired_.size() + 1);
+		reserve(free_, free_.size() + retired_.size() + 1);
+		DepthSnapshot *snapshot = new_snapshot();
+		snapshot->time = time;
+		snapshot->sequence = ++sequence_;
+		snapshot->level_count = order_book.copy_depth(snapshot->levels.data(), depth_);
+
+		DepthSnapshot *old = current_.exchange(snapshot, std::memory_order_seq_cst);
+		if (old) {
+			old->retire_epoch = epoch_.fetch_add(1, std::memory_order_seq_cst);
+			retired_.push_back(old);
+		}
+		reclaim();
+	}
+};
+
+#endif  // TWAP_DEPTH_PUBLISHER_H_
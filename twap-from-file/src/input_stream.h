@@ -0,0 +1,380 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_INPUT_STREAM_H_
+#define TWAP_INPUT_STREAM_H_
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef TWAP_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef TWAP_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+// Source of input bytes for LineReader.
+//
+class InputStream {
+
+public:
+
+	virtual ~InputStream() {
+	}
+
+	// Reads up to size bytes into data, returns 0 at the end of input.
+	virtual size_t read(char *data, size_t size) = 0;
+
+	// Returns the error that ended the input early, if any.
+	virtual std::string error() const {
+		return std::string();
+	}
+
+	// Compressed input offsets don't match the file offsets.
+	virtual bool compressed() const {
+		return false;
+	}
+};
+
+// Reads bytes from a file as they are, after the bytes that were
+// already read from it (to detect the format), so that the file
+// doesn't need to be seekable.
+//
+class FileInputStream : public InputStream {
+
+private:
+
+	FILE *file_;
+	std::string prefix_;
+	size_t prefix_pos_;
+
+public:
+
+	explicit FileInputStream(FILE *file, const std::string &prefix = std::string())
+		: prefix_(prefix) {
+		file_ = file;
+		prefix_pos_ = 0;
+	}
+
+	size_t read(char *data, size_t size) {
+		if (prefix_pos_ < prefix_.size()) {
+			const size_t count = std::min(size, prefix_.size() - prefix_pos_);
+			std::memcpy(data, prefix_.data() + prefix_pos_, count);
+			prefix_pos_ += count;
+			return count;
+		}
+		return std::fread(data, 1, size, file_);
+	}
+};
+
+// Decompresses one block of data at a time from a compressed stream.
+//
+class Decoder {
+
+protected:
+
+	FileInputStream source_;
+
+public:
+
+	explicit Decoder(const FileInputStream &source) : source_(source) {
+	}
+
+	virtual ~Decoder() {
+	}
+
+	// Decompresses up to capacity bytes into data, setting count to 0
+	// at the end of input. Returns false and sets error on failure.
+	virtual bool decode(char *data, size_t capacity, size_t &count, std::string &error) = 0;
+};
+
+#ifdef TWAP_WITH_ZLIB
+
+// Decodes gzip (including concatenated members) or zlib stream.
+//
+class GzipDecoder : public Decoder {
+
+private:
+
+	z_stream stream_;
+	std::vector<unsigned char> input_;
+	bool eof_;
+	bool in_member_; // inside a gzip member, which hasn't ended yet
+
+public:
+
+	explicit GzipDecoder(const FileInputStream &source, const size_t input_size = 1 << 18)
+		: Decoder(source), input_(input_size) {
+		eof_ = false;
+		in_member_ = false;
+		std::memset(&stream_, 0, sizeof(stream_));
+		inflateInit2(&stream_, 15 + 32); // detect gzip or zlib header
+	}
+
+	~GzipDecoder() {
+		inflateEnd(&stream_);
+	}
+
+	bool decode(char *data, size_t capacity, size_t &count, std::string &error) {
+		stream_.next_out = reinterpret_cast<unsigned char *>(data);
+		stream_.avail_out = (unsigned)capacity;
+		while (stream_.avail_out > 0) {
+			if (stream_.avail_in == 0) {
+				if (eof_) {
+					break;
+				}
+				stream_.next_in = &input_[0];
+				stream_.avail_in = (unsigned)source_.read(reinterpret_cast<char *>(&input_[0]), input_.size());
+				if (stream_.avail_in == 0) {
+					eof_ = true;
+					break;
+				}
+			}
+			const int result = inflate(&stream_, Z_NO_FLUSH);
+			in_member_ = result != Z_STREAM_END;
+			if (result == Z_STREAM_END) {
+				inflateReset(&stream_); // next gzip member, if any
+			} else if (result != Z_OK && result != Z_BUF_ERROR) {
+				error = stream_.msg ? stream_.msg : "corrupt gzip data";
+				return false;
+			}
+		}
+		count = capacity - stream_.avail_out;
+		if (count == 0 && in_member_) {
+			error = "unexpected end of gzip data";
+			return false;
+		}
+		return true;
+	}
+};
+
+#endif
+
+#ifdef TWAP_WITH_ZSTD
+
+// Decodes zstd stream (including concatenated frames).
+//
+class ZstdDecoder : public Decoder {
+
+private:
+
+	ZSTD_DCtx *context_;
+	std::vector<char> input_;
+	ZSTD_inBuffer in_;
+	bool eof_;
+	bool in_frame_; // inside a zstd frame, which hasn't ended yet
+
+public:
+
+	explicit ZstdDecoder(const FileInputStream &source)
+		: Decoder(source), input_(ZSTD_DStreamInSize()) {
+		context_ = ZSTD_createDCtx();
+		in_.src = &input_[0];
+		in_.size = 0;
+		in_.pos = 0;
+		eof_ = false;
+		in_frame_ = false;
+	}
+
+	~ZstdDecoder() {
+		ZSTD_freeDCtx(context_);
+	}
+
+	bool decode(char *data, size_t capacity, size_t &count, std::string &error) {
+		ZSTD_outBuffer out = { data, capacity, 0 };
+		while (out.pos < out.size) {
+			if (in_.pos == in_.size) {
+				if (eof_) {
+					break;
+				}
+				in_.size = source_.read(&input_[0], input_.size());
+				in_.pos = 0;
+				if (in_.size == 0) {
+					eof_ = true;
+					break;
+				}
+			}
+			const size_t result = ZSTD_decompressStream(context_, &out, &in_);
+			if (ZSTD_isError(result)) {
+				error = ZSTD_getErrorName(result);
+				return false;
+			}
+			in_frame_ = result != 0;
+		}
+		count = out.pos;
+		if (count == 0 && in_frame_) {
+			error = "unexpected end of zstd data";
+			return false;
+		}
+		return true;
+	}
+};
+
+#endif
+
+// Decompresses a file on a helper thread, which fills a few blocks
+// ahead of the reader, so that decompression overlaps with parsing
+// and no uncompressed copy of the file is ever written to disk.
+//
+// The threads only synchronise once per block (1MB by default),
+// not per line, so the cost of the handoff is negligible.
+//
+class DecompressingInputStream : public InputStream {
+
+private:
+
+	static const size_t kBlockCount = 4;
+
+	Decoder *decoder_;
+	std::vector<std::vector<char> > blocks_;
+	std::vector<size_t> block_sizes_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable changed_;
+	size_t produced_; // blocks filled by the helper thread
+	size_t consumed_; // blocks fully read by the reader
+	bool finished_;
+	bool stop_;
+	std::string error_;
+
+	size_t read_pos_; // position in the current block
+	std::thread thread_;
+
+	void run() {
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				while (produced_ - consumed_ == kBlockCount && !stop_) {
+					changed_.wait(lock);
+				}
+				if (stop_) {
+					return;
+				}
+			}
+
+			// only this thread writes to the block until it is published
+			const size_t index = produced_ % kBlockCount;
+			std::vector<char> &block = blocks_[index];
+			size_t count = 0;
+			std::string error;
+			const bool ok = decoder_->decode(&block[0], block.size(), count, error);
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!ok || count == 0) {
+				error_ = error;
+				finished_ = true;
+				changed_.notify_all();
+				return;
+			}
+			block_sizes_[index] = count;
+			produced_++;
+			changed_.notify_all();
+		}
+	}
+
+public:
+
+	// Takes ownership of the decoder.
+	explicit DecompressingInputStream(Decoder *decoder, const size_t block_size = 1 << 20)
+		: blocks_(kBlockCount, std::vector<char>(block_size)), block_sizes_(kBlockCount) {
+		decoder_ = decoder;
+		produced_ = 0;
+		consumed_ = 0;
+		finished_ = false;
+		stop_ = false;
+		read_pos_ = 0;
+		thread_ = std::thread(&DecompressingInputStream::run, this);
+	}
+
+	~DecompressingInputStream() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+			changed_.notify_all();
+		}
+		thread_.join();
+		delete decoder_;
+	}
+
+	size_t read(char *data, size_t size) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (consumed_ == produced_ && !finished_) {
+			changed_.wait(lock);
+		}
+		if (consumed_ == produced_) {
+			return 0;
+		}
+		lock.unlock();
+
+		// the block is not touched by the helper thread until consumed
+		const size_t index = consumed_ % kBlockCount;
+		const size_t count = std::min(size, block_sizes_[index] - read_pos_);
+		std::memcpy(data, &blocks_[index][read_pos_], count);
+		read_pos_ += count;
+
+		if (read_pos_ == block_sizes_[index]) {
+			read_pos_ = 0;
+			lock.lock();
+			consumed_++;
+			changed_.notify_all();
+		}
+		return count;
+	}
+
+	std::string error() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return error_;
+	}
+
+	bool compressed() const {
+		return true;
+	}
+};
+
+// Creates the input stream for the file, decompressing it on a helper
+// thread if it starts with gzip or zstd magic bytes. Returns null and
+// sets error if the file is compressed with an unsupported format.
+// The file must stay open while the stream is used.
+//
+inline InputStream *open_input_stream(FILE *file, std::string &error) {
+
+	char magic[4];
+	const size_t count = std::fread(magic, 1, sizeof(magic), file);
+	if (std::ferror(file)) {
+		error = std::strerror(errno);
+		return 0;
+	}
+	const FileInputStream source(file, std::string(magic, count));
+	const bool is_gzip = count >= 2 && std::memcmp(magic, "\x1f\x8b", 2) == 0;
+	const bool is_zstd = count >= 4 && std::memcmp(magic, "\x28\xb5\x2f\xfd", 4) == 0;
+
+	if (is_gzip) {
+#ifdef TWAP_WITH_ZLIB
+		return new DecompressingInputStream(new GzipDecoder(source));
+#else
+		error = "gzip input is not supported, please build with -DTWAP_WITH_ZLIB";
+		return 0;
+#endif
+	}
+
+	if (is_zstd) {
+#ifdef TWAP_WITH_ZSTD
+		return new DecompressingInputStream(new ZstdDecoder(source));
+#else
+		error = "zstd input is not supported, please build with -DTWAP_WITH_ZSTD";
+		return 0;
+#endif
+	}
+
+	return new FileInputStream(source);
+}
+
+#endif  // TWAP_INPUT_STREAM_H_
@@ -0,0 +1,187 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_LATENCY_HISTOGRAM_H_
+#define TWAP_LATENCY_HISTOGRAM_H_
+
+#include <cmath>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "binary_io.h"
+
+// Counts values (latencies in nanoseconds) in log-scaled buckets,
+// same as HdrHistogram does.
+//
+// Values below 2^(kSubBucketBits + 1) are counted exactly. Above
+// that, each power of two range is split into 2^kSubBucketBits
+// equal sub-buckets, so any value is counted with a relative error
+// of less than 1% (for 7 bits), while the whole 64-bit range only
+// needs a few thousand buckets.
+//
+// Histograms with the same number of sub-bucket bits can be merged,
+// so that the runs (or different backends) can be dumped to binary
+// files and compared or combined later, see write() and read().
+// The dump uses the native byte order.
+//
+class LatencyHistogram {
+
+private:
+
+	static const int kSubBucketBits = 7;
+	static const int kSubBucketCount = 1 << kSubBucketBits;
+	static const int kBucketCount = (65 - kSubBucketBits) * kSubBucketCount;
+	static const unsigned int kDumpVersion = 1;
+
+	std::vector<unsigned long long> counts_;
+	unsigned long long total_count_;
+	unsigned long long min_value_;
+	unsigned long long max_value_;
+
+	static int bucket_index(const unsigned long long value) {
+		if (value < 2 * kSubBucketCount) {
+			return (int)value;
+		}
+		const int shift = 63 - __builtin_clzll(value) - kSubBucketBits;
+		return shift * kSubBucketCount + (int)(value >> shift);
+	}
+
+	// highest value that is counted in the bucket
+	static unsigned long long bucket_value(const int index) {
+		if (index < 2 * kSubBucketCount) {
+			return index;
+		}
+		const int shift = (index >> kSubBucketBits) - 1;
+		const unsigned long long sub_bucket = index - shift * kSubBucketCount;
+		return ((sub_bucket + 1) << shift) - 1;
+	}
+
+public:
+
+	LatencyHistogram() : counts_(kBucketCount, 0) {
+		total_count_ = 0;
+		min_value_ = std::numeric_limits<unsigned long long>::max();
+		max_value_ = 0;
+	}
+
+	void record(const unsigned long long value) {
+		counts_[bucket_index(value)]++;
+		total_count_++;
+		if (min_value_ > value) {
+			min_value_ = value;
+		}
+		if (max_value_ < value) {
+			max_value_ = value;
+		}
+	}
+
+	void merge(const LatencyHistogram &other) {
+		for (int i = 0; i < kBucketCount; i++) {
+			counts_[i] += other.counts_[i];
+		}
+		total_count_ += other.total_count_;
+		if (min_value_ > other.min_value_) {
+			min_value_ = other.min_value_;
+		}
+		if (max_value_ < other.max_value_) {
+			max_value_ = other.max_value_;
+		}
+	}
+
+	unsigned long long total_count() const {
+		return total_count_;
+	}
+
+	// value at or below which the given percent of values are,
+	// reported as the highest value of its bucket (but not above max)
+	unsigned long long percentile(const double percent) const {
+		if (total_count_ == 0) {
+			return 0;
+		}
+		unsigned long long target = (unsigned long long)std::ceil(percent / 100.0 * total_count_);
+		if (target < 1) {
+			target = 1;
+		}
+		unsigned long long count = 0;
+		for (int i = 0; i < kBucketCount; i++) {
+			count += counts_[i];
+			if (count >= target) {
+				const unsigned long long value = bucket_value(i);
+				return value < max_value_ ? value : max_value_;
+			}
+		}
+		return max_value_;
+	}
+
+	void report(std::ostream &out) const {
+		out << "LATENCY: " << total_count_ << " events";
+		if (total_count_ > 0) {
+			out << ", min " << min_value_
+				<< " ns, p50 " << percentile(50.0)
+				<< " ns, p99 " << percentile(99.0)
+				<< " ns, p99.9 " << percentile(99.9)
+				<< " ns, max " << max_value_ << " ns";
+		}
+		out << std::endl;
+	}
+
+	// only non-empty buckets are written
+	void write(std::ostream &out) const {
+		out.write("TWAPHIST", 8);
+		write_value<unsigned int>(out, kDumpVersion);
+		write_value<unsigned int>(out, kSubBucketBits);
+		write_value<unsigned long long>(out, total_count_);
+		write_value<unsigned long long>(out, min_value_);
+		write_value<unsigned long long>(out, max_value_);
+		unsigned int used_buckets = 0;
+		for (int i = 0; i < kBucketCount; i++) {
+			if (counts_[i] > 0) {
+				used_buckets++;
+			}
+		}
+		write_value<unsigned int>(out, used_buckets);
+		for (int i = 0; i < kBucketCount; i++) {
+			if (counts_[i] > 0) {
+				write_value<unsigned int>(out, i);
+				write_value<unsigned long long>(out, counts_[i]);
+			}
+		}
+	}
+
+	// merges the dump into this histogram, returns false
+	// if the input is not a compatible histogram dump
+	bool read(std::istream &in) {
+		char magic[8];
+		if (!in.read(magic, 8) || std::string(magic, 8).compare("TWAPHIST") != 0) {
+			return false;
+		}
+		unsigned int version;
+		unsigned int sub_bucket_bits;
+		if (!read_value(in, version) || version != kDumpVersion ||
+			!read_value(in, sub_bucket_bits) || sub_bucket_bits != kSubBucketBits) {
+			return false;
+		}
+		LatencyHistogram other;
+		unsigned int used_buckets;
+		if (!read_value(in, other.total_count_) ||
+			!read_value(in, other.min_value_) ||
+			!read_value(in, other.max_value_) ||
+			!read_value(in, used_buckets)) {
+			return false;
+		}
+		for (unsigned int i = 0; i < used_buckets; i++) {
+			unsigned int index;
+			unsigned long long count;
+			if (!read_value(in, index) || index >= kBucketCount || !read_value(in, count)) {
+				return false;
+			}
+			other.counts_[index] = count;
+		}
+		merge(other);
+		return true;
+	}
+};
+
+#endif  // TWAP_LATENCY_HISTOGRAM_H_
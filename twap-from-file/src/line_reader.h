@@ -0,0 +1,214 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_LINE_READER_H_
+#define TWAP_LINE_READER_H_
+
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "input_stream.h"
+#include "order_event.h"
+
+// Reads lines from an input stream into a buffer, which is only reallocated
+// if a line doesn't fit in it, so reading doesn't allocate memory.
+//
+// The lines are returned as pointers into the buffer, which are only
+// valid until the next line is read. Each line is terminated with '\0'
+// in place of the new line character, so it can be parsed with the
+// standard C functions.
+//
+class LineReader {
+
+private:
+
+	InputStream &input_;
+	std::vector<char> buffer_;
+	size_t begin_; // start of the next line
+	size_t end_;   // end of the data in the buffer
+	bool eof_;
+	long long input_offset_; // offset of the end of the data in the input
+
+public:
+
+	explicit LineReader(InputStream &input, const size_t buffer_size = 1 << 20)
+		: input_(input), buffer_(buffer_size + 1) {
+		begin_ = 0;
+		end_ = 0;
+		eof_ = false;
+		input_offset_ = 0;
+	}
+
+	// Returns the offset of the next line in the input.
+	long long offset() const {
+		return input_offset_ - (long long)(end_ - begin_);
+	}
+
+	// Returns false when there are no more lines.
+	bool next_line(char *&line, char *&line_end) {
+		while (true) {
+
+			char *data = &buffer_[0];
+			char *new_line = static_cast<char *>(std::memchr(data + begin_, '\n', end_ - begin_));
+
+			if (new_line || (eof_ && begin_ < end_)) {
+				line = data + begin_;
+				line_end = new_line ? new_line : data + end_;
+				*line_end = '\0'; // there is always space for it in the buffer
+				begin_ = new_line ? line_end - data + 1 : end_;
+				return true;
+			}
+
+			if (eof_) {
+				return false;
+			}
+
+			// move the incomplete line to the start of the buffer
+			std::memmove(data, data + begin_, end_ - begin_);
+			end_ -= begin_;
+			begin_ = 0;
+
+			if (end_ == buffer_.size() - 1) {
+				buffer_.resize(buffer_.size() * 2); // line longer than the buffer
+				data = &buffer_[0];
+			}
+
+			const size_t count = input_.read(data + end_, buffer_.size() - 1 - end_);
+			end_ += count;
+			input_offset_ += count;
+			if (count == 0) {
+				eof_ = true;
+			}
+		}
+	}
+};
+
+// Parses an int after optional white space, moving the pointer past it.
+//
+inline bool parse_int(const char *&pos, int &value) {
+	char *end;
+	errno = 0;
+	const long result = std::strtol(pos, &end, 10);
+	if (end == pos || errno == ERANGE ||
+		result < std::numeric_limits<int>::min() ||
+		result > std::numeric_limits<int>::max()) {
+		return false;
+	}
+	value = (int)result;
+	pos = end;
+	return true;
+}
+
+// Parses a double after optional white space, moving the pointer past it.
+//
+// Only takes the decimal form [sign]digits[.digits][e[sign]digits], same
+// as operator>>, so "nan", "inf" and hex floats are not prices (strtod
+// takes them all). The values which overflow are rejected too.
+//
+inline bool parse_double(const char *&pos, double &value) {
+	while (std::isspace((unsigned char)*pos)) {
+		pos++;
+	}
+	const char *end = pos;
+	if (*end == '+' || *end == '-') {
+		end++;
+	}
+	size_t digits = 0;
+	while (std::isdigit((unsigned char)*end)) {
+		end++;
+		digits++;
+	}
+	if (*end == '.') {
+		end++;
+		while (std::isdigit((unsigned char)*end)) {
+			end++;
+			digits++;
+		}
+	}
+	if (digits == 0) {
+		return false;
+	}
+	if (*end == 'e' || *end == 'E') {
+		const char *exponent = end + 1;
+		if (*exponent == '+' || *exponent == '-') {
+			exponent++;
+		}
+		if (std::isdigit((unsigned char)*exponent)) {
+			end = exponent;
+			while (std::isdigit((unsigned char)*end)) {
+				end++;
+			}
+		}
+	}
+
+	// strtod would go on past the decimal form (e.g. "0x1p3"), so
+	// it parses a copy, which is only long in the odd input
+	char number[64];
+	const size_t length = end - pos;
+	if (length >= sizeof(number)) {
+		const std::string copy(pos, end);
+		value = std::strtod(copy.c_str(), NULL);
+	} else {
+		std::memcpy(number, pos, length);
+		number[length] = '\0';
+		value = std::strtod(number, NULL);
+	}
+	if (!std::isfinite(value)) {
+		return false;
+	}
+	pos = end;
+	return true;
+}
+
+// Parses the line "time operation order_id [price]" terminated with '\0',
+// where price is only required for insert operation, and anything after
+// the last field is ignored. Returns false if the line is malformed.
+//
+// Same as reading each field with operator>>, but without allocating
+// memory for the strings.
+//
+inline bool parse_order_event(const char *line, OrderEvent &event) {
+
+	const char *pos = line;
+
+	if (!parse_int(pos, event.time)) {
+		return false; // no time in this line
+	}
+
+	while (std::isspace((unsigned char)*pos)) {
+		pos++;
+	}
+	const char *operation = pos;
+	while (*pos != '\0' && !std::isspace((unsigned char)*pos)) {
+		pos++;
+	}
+	if (pos == operation) {
+		return false; // no operation in this line
+	}
+	if (pos - operation == 1 && (*operation == 'I' || *operation == 'E')) {
+		event.operation = *operation;
+	} else {
+		event.operation = 0;
+	}
+
+	if (!parse_int(pos, event.order_id)) {
+		return false; // no order_id in this line
+	}
+
+	event.price = 0.0;
+	if (event.operation == 'I') {
+		if (!parse_double(pos, event.price)) {
+			return false; // no price in this line
+		}
+	}
+
+	return true;
+}
+
+#endif  // TWAP_LINE_READER_H_
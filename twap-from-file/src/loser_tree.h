@@ -0,0 +1,112 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_LOSER_TREE_H_
+#define TWAP_LOSER_TREE_H_
+
+#include <cstddef>
+#include <vector>
+
+// Tournament tree of the loser type, for merging k sorted sequences by
+// time: it keeps the current time of each sequence, and finds the one
+// with the earliest time, which is the winner.
+//
+// Each internal node remembers the loser of the match between its two
+// subtrees, so when the winner moves on to its next time, it only plays
+// the losers on the path from its leaf to the root, which is log2(k)
+// comparisons, each with one other sequence (unlike a binary heap, which
+// compares both children at each level).
+//
+// Equal times are won by the sequence with the lower index, so that the
+// merge is stable, and the sequences that are done lose to all others.
+//
+class LoserTree {
+
+private:
+
+	size_t count_;
+	std::vector<int> times_;
+	std::vector<bool> done_;
+
+	// losers_[0] is the winner, losers_[n] is the loser at node n, where
+	// the children of node n are 2n and 2n + 1, and sequence i is leaf count_ + i
+	std::vector<size_t> losers_;
+
+	bool wins(const size_t a, const size_t b) const {
+		if (done_[a] || done_[b]) {
+			return !done_[a] && done_[b];
+		}
+		return times_[a] < times_[b] || (times_[a] == times_[b] && a < b);
+	}
+
+	// plays the sequence from its leaf up to the root
+	void replay(size_t winner) {
+		for (size_t node = (count_ + winner) / 2; node > 0; node /= 2) {
+			if (wins(losers_[node], winner)) {
+				const size_t loser = winner;
+				winner = losers_[node];
+				losers_[node] = loser;
+			}
+		}
+		losers_[0] = winner;
+	}
+
+public:
+
+	// Starts with all sequences done, see set() and build().
+	explicit LoserTree(const size_t count) {
+		count_ = count > 0 ? count : 1;
+		times_.resize(count_, 0);
+		done_.resize(count_, true);
+		losers_.resize(count_, 0);
+	}
+
+	// Sets the first time of the sequence, before build().
+	void set(const size_t sequence, const int time) {
+		times_[sequence] = time;
+		done_[sequence] = false;
+	}
+
+	// Plays all the matches, after the first times are set.
+	void build() {
+		std::vector<size_t> winners(2 * count_);
+		for (size_t i = 0; i < count_; i++) {
+			winners[count_ + i] = i;
+		}
+		for (size_t node = count_ - 1; node > 0; node--) {
+			const size_t left = winners[2 * node];
+			const size_t right = winners[2 * node + 1];
+			if (wins(left, right)) {
+				winners[node] = left;
+				losers_[node] = right;
+			} else {
+				winners[node] = right;
+				losers_[node] = left;
+			}
+		}
+		losers_[0] = count_ > 1 ? winners[1] : 0;
+	}
+
+	// Returns true if all the sequences are done.
+	bool empty() const {
+		return done_[losers_[0]];
+	}
+
+	// Index of the sequence with the earliest time.
+	size_t winner() const {
+		return losers_[0];
+	}
+
+	// Moves the winner on to its next time.
+	void next(const int time) {
+		times_[losers_[0]] = time;
+		replay(losers_[0]);
+	}
+
+	// Marks the winner as done.
+	void finish() {
+		done_[losers_[0]] = true;
+		replay(losers_[0]);
+	}
+};
+
+#endif  // TWAP_LOSER_TREE_H_
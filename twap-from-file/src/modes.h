@@ -0,0 +1,105 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_MODES_H_
+#define TWAP_MODES_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "output_writer.h"
+#include "replay.h"
+
+// Modes of the program, selected by the options in main(). Each one
+// returns the exit code of the program, after printing the errors.
+//
+// The modes which write TWAP of the input are in twap_modes.cpp, the
+// queries over the input in query_modes.cpp, and the ones which only
+// move data around in tool_modes.cpp.
+
+// Processes the events from the file, writing TWAP to the output.
+//
+int run_file(const std::string &file_name, const Options &options, OutputWriter &output);
+
+// Processes the events from all the files (each sorted by time) merged
+// by time, as if they were one file, writing TWAP to the output.
+//
+int run_merged_files(const std::vector<std::string> &file_names, const Options &options,
+		OutputWriter &output);
+
+// Processes each file with its own order book and TWAP, on a pool
+// of threads, writing TWAP into a file with the same name and the
+// extension ".twap" in the output directory. The largest files are
+// scheduled first, to finish the batch as early as possible. Fails
+// upfront if two inputs have the same name (in different directories),
+// as they would be written to the same output file.
+//
+// Prints a summary "file size_bytes output_lines seconds result"
+// for each file to stdout, and returns 1 if any of them failed.
+//
+int run_batch(const std::vector<std::string> &file_names, const std::string &output_dir,
+		size_t thread_count, const Options &options);
+
+// Creates the shared memory ring, and processes the events that
+// a producer publishes into it, until it closes the ring, writing
+// TWAP to the output.
+//
+int run_ring(const std::string &ring_name, const size_t ring_capacity, const bool busy_poll,
+		const Options &options, OutputWriter &output);
+
+// Replays the (uncompressed) file split into chunks on the threads,
+// see ParallelReplay, writing TWAP to the output.
+//
+int run_parallel_replay(const std::string &file_name, const size_t thread_count,
+		const Options &options, OutputWriter &output);
+
+// Replays the file and writes the index of it, with a snapshot
+// of the order book every interval events, see TimeIndex. The
+// snapshots include the initial book, if any, so the range queries
+// with the index must be given the same one.
+//
+int run_build_index(const std::string &file_name, const std::string &index_file_name,
+		const long interval, const Options &options);
+
+// Prints TWAP of the max price over the time range [begin_time,
+// end_time] to stdout. With the index, the replay starts from the
+// nearest snapshot before the range, otherwise from the beginning
+// of the file (and the initial book).
+//
+int run_range_query(const std::string &file_name, const std::string &index_file_name,
+		const int begin_time, const int end_time, const Options &options);
+
+// Replays the file into the step function of the max price, and then
+// answers the queries "begin_time end_time" from the query file, one
+// per line, printing TWAP over each of the intervals to stdout.
+//
+int run_twap_queries(const std::string &file_name, const std::string &query_file_name,
+		const Options &options);
+
+// Replays the file into TwapAccumulator, optionally ending the last price
+// at the session end time, writes it to the state file and prints it.
+//
+int run_accumulate(const std::string &file_name, const std::string &state_file_name,
+		const bool has_session_end, const int session_end_time, const Options &options);
+
+// Merges the TWAP states from the files in the given (time) order,
+// prints the result and optionally writes it to a state file.
+//
+int run_merge_states(const std::vector<std::string> &file_names, const std::string &out_file_name);
+
+// Merges histogram dumps from the files, reports the percentiles
+// to stdout and optionally writes the merged histogram to a file.
+//
+int run_latency_report(const std::vector<std::string> &file_names, const std::string &dump_file_name);
+
+// Prints the latest quotes of the given instruments (or all of them)
+// from the shared memory table, as "instrument time max_price twap".
+//
+int run_table_reader(const std::string &table_name, const std::vector<std::string> &instruments);
+
+// Publishes the events from the file into the shared memory ring,
+// standing in for the feed handler process.
+//
+int run_ring_producer(const std::string &ring_name, const std::string &file_name);
+
+#endif  // TWAP_MODES_H_
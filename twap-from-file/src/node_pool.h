@@ -0,0 +1,330 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_NODE_POOL_H_
+#define TWAP_NODE_POOL_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Counts memory used by a container, see NodePool.
+//
+// Only the requested bytes are counted, i.e. the overhead
+// of the memory allocator itself is not included.
+//
+struct AllocationStats {
+
+	size_t bytes;          // in use by the container
+	size_t peak_bytes;     // max bytes in use
+	size_t reserved_bytes; // obtained from the system
+	size_t allocations;    // number of system allocations
+
+	AllocationStats() {
+		bytes = 0;
+		peak_bytes = 0;
+		reserved_bytes = 0;
+		allocations = 0;
+	}
+};
+
+// Pool of equally sized memory blocks for the nodes of a container.
+//
+// Freed nodes are kept in a free list and reused, therefore once the
+// pool has grown to the peak number of nodes, the container no longer
+// allocates from the system. Memory is obtained in chunks, each one as
+// large as all previous chunks together (or as the reserved capacity),
+// but not larger than kMaxChunkBytes. On Linux the chunks are mapped
+// from the system directly, rather than taken from the heap, so that a
+// chunk can be returned a page at a time (see release_slice()), and the
+// time it takes doesn't depend on the state of the heap (freeing a heap
+// block can trim megabytes off the top of the heap at once). Their pages
+// are faulted in when they are mapped, rather than by the node which
+// first touches them.
+//
+// The node size is only known when the container allocates the first
+// node, so reserve() called before that takes effect at that time.
+//
+class NodePool {
+
+private:
+
+	struct FreeNode {
+		FreeNode *next;
+	};
+
+	static const size_t kMinChunkNodes = 256;
+
+	// largest chunk, larger reservations are split into several
+	static const size_t kMaxChunkBytes = 64 << 10;
+
+	// largest chunk added by reserve_chunk(), two pages
+	static const size_t kReserveChunkBytes = 8 << 10;
+
+	AllocationStats stats_;
+	size_t request_size_; // size of the nodes requested by the container
+	size_t node_size_;
+	size_t capacity_; // nodes in all chunks
+	size_t reserve_nodes_;
+	FreeNode *free_list_;
+	char *chunk_pos_;
+	char *chunk_end_;
+	std::vector<char *> chunks_;
+	std::vector<size_t> chunk_nodes_;
+	size_t next_chunk_; // the chunks before it are used for nodes
+	size_t released_bytes_; // of the last chunk, see release_slice()
+
+#ifdef __linux__
+	static size_t page_size() {
+		static const size_t size = sysconf(_SC_PAGESIZE);
+		return size;
+	}
+
+	// the chunk takes whole pages
+	size_t chunk_bytes(const size_t nodes) const {
+		return (nodes * node_size_ + page_size() - 1) / page_size() * page_size();
+	}
+
+	static char *new_chunk(const size_t bytes) {
+		void *chunk = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		if (chunk == MAP_FAILED) {
+			throw std::bad_alloc();
+		}
+		return static_cast<char *>(chunk);
+	}
+
+	static void delete_chunk(char *chunk, const size_t bytes) {
+		munmap(chunk, bytes);
+	}
+#else
+	size_t chunk_bytes(const size_t nodes) const {
+		return nodes * node_size_;
+	}
+
+	static char *new_chunk(const size_t bytes) {
+		return static_cast<char *>(::operator new(bytes));
+	}
+
+	static void delete_chunk(char *chunk, size_t) {
+		::operator delete(chunk);
+	}
+#endif
+
+	// adds a chunk of the given number of nodes, or of as many
+	// as fit into kMaxChunkBytes, if that is less (or as many
+	// as fit into its whole pages, if that is more), which is
+	// used for nodes when the chunks before it are
+	void add_chunk(size_t nodes) {
+		nodes = std::min(nodes, std::max(kMaxChunkBytes / node_size_, (size_t)1));
+		nodes = chunk_bytes(nodes) / node_size_;
+		// so that the chunk is not lost if the lists can't grow
+		if (chunks_.size() == chunks_.capacity()) {
+			chunks_.reserve(2 * chunks_.capacity());
+			chunk_nodes_.reserve(chunks_.capacity());
+		}
+		char *chunk = new_chunk(chunk_bytes(nodes));
+		chunks_.push_back(chunk);
+		chunk_nodes_.push_back(nodes);
+		capacity_ += nodes;
+		stats_.reserved_bytes += nodes * node_size_;
+		stats_.allocations++;
+	}
+
+public:
+
+	NodePool() {
+		request_size_ = 0;
+		node_size_ = 0;
+		capacity_ = 0;
+		reserve_nodes_ = 0;
+		free_list_ = 0;
+		chunk_pos_ = 0;
+		chunk_end_ = 0;
+		chunks_.reserve(64);
+		chunk_nodes_.reserve(64);
+		next_chunk_ = 0;
+		released_bytes_ = 0;
+	}
+
+	~NodePool() {
+		for (size_t i = 0; i + 1 < chunks_.size(); i++) {
+			delete_chunk(chunks_[i], chunk_bytes(chunk_nodes_[i]));
+		}
+		if (!chunks_.empty()) {
+			// the last one may be partly released
+			delete_chunk(chunks_.back() + released_bytes_, chunk_bytes(chunk_nodes_.back()) - released_bytes_);
+		}
+	}
+
+	// makes sure the pool can hold this many nodes without allocating
+	void reserve(const size_t nodes) {
+		reserve_nodes_ = nodes;
+		while (node_size_ > 0 && capacity_ < reserve_nodes_) {
+			add_chunk(reserve_nodes_ - capacity_);
+		}
+	}
+
+	// Same as reserve(), but only records the number of nodes, which
+	// are then reserved by reserve_chunk(), so that a large pool can be
+	// reserved in steps of bounded time.
+	void reserve_later(const size_t nodes) {
+		reserve_nodes_ = nodes;
+	}
+
+	// Adds a chunk of up to kReserveChunkBytes towards the nodes given
+	// to reserve_later() (once the node size is known), returns false
+	// if there is nothing to add.
+	bool reserve_chunk() {
+		if (node_size_ == 0 || capacity_ >= reserve_nodes_) {
+			return false;
+		}
+		add_chunk(std::min(reserve_nodes_ - capacity_, std::max(kReserveChunkBytes / node_size_, (size_t)1)));
+		return true;
+	}
+
+	void *allocate(const size_t size) {
+
+		if (request_size_ == 0) {
+			request_size_ = size;
+			node_size_ = std::max(size, sizeof(FreeNode));
+			reserve(reserve_nodes_);
+		}
+
+		if (size != request_size_) {
+			return ::operator new(size); // not a node, never happens for maps
+		}
+
+		void *node;
+		if (free_list_) {
+			node = free_list_;
+			free_list_ = free_list_->next;
+		} else {
+			if (chunk_pos_ == chunk_end_) {
+				// if this throws, nothing is counted
+				if (next_chunk_ == chunks_.size()) {
+					add_chunk(std::max(capacity_, (size_t)kMinChunkNodes));
+				}
+				chunk_pos_ = chunks_[next_chunk_];
+				chunk_end_ = chunk_pos_ + chunk_nodes_[next_chunk_] * node_size_;
+				next_chunk_++;
+			}
+			node = chunk_pos_;
+			chunk_pos_ += node_size_;
+		}
+
+		stats_.bytes += node_size_;
+		if (stats_.peak_bytes < stats_.bytes) {
+			stats_.peak_bytes = stats_.bytes;
+		}
+		return node;
+	}
+
+	void deallocate(void *p, const size_t size) {
+
+		if (size != request_size_) {
+			::operator delete(p);
+			return;
+		}
+
+		stats_.bytes -= node_size_;
+
+		FreeNode *node = static_cast<FreeNode *>(p);
+		node->next = free_list_;
+		free_list_ = node;
+	}
+
+	// number of nodes in all chunks
+	size_t capacity() const {
+		return capacity_;
+	}
+
+	// Returns a page of the last chunk to the system (or the whole chunk,
+	// if not on Linux), when the container has freed all its nodes, so
+	// that a large pool can be released in steps of bounded time. Returns
+	// false if there are no chunks left (or nodes are in use). The pool
+	// can be used again after all the chunks are released.
+	bool release_slice() {
+		if (stats_.bytes > 0 || chunks_.empty()) {
+			return false;
+		}
+		free_list_ = 0;
+		chunk_pos_ = 0;
+		chunk_end_ = 0;
+		const size_t bytes = chunk_bytes(chunk_nodes_.back());
+#ifdef __linux__
+		// the pages are unmapped from the start, which is the start of
+		// the area mapped for the pool too (the system maps the newer
+		// chunks below the older ones, and merges the adjacent ones),
+		// so that the area shrinks, rather than splits
+		munmap(chunks_.back() + released_bytes_, page_size());
+		released_bytes_ += page_size();
+		if (released_bytes_ < bytes) {
+			return true;
+		}
+		released_bytes_ = 0;
+#else
+		delete_chunk(chunks_.back(), bytes);
+#endif
+		capacity_ -= chunk_nodes_.back();
+		stats_.reserved_bytes -= chunk_nodes_.back() * node_size_;
+		chunks_.pop_back();
+		chunk_nodes_.pop_back();
+		next_chunk_ = chunks_.size();
+		return true;
+	}
+
+	const AllocationStats &stats() const {
+		return stats_;
+	}
+};
+
+// Standard allocator, which allocates from the given node pool.
+// Containers copy their allocator, so all copies share the same
+// pool (including rebound ones, e.g. for map nodes).
+//
+template <typename T>
+class PoolAllocator {
+
+	template <typename U> friend class PoolAllocator;
+
+private:
+
+	NodePool *pool_;
+
+public:
+
+	typedef T value_type;
+
+	explicit PoolAllocator(NodePool *pool) {
+		pool_ = pool;
+	}
+
+	template <typename U>
+	PoolAllocator(const PoolAllocator<U> &other) {
+		pool_ = other.pool_;
+	}
+
+	T *allocate(const size_t n) {
+		return static_cast<T *>(pool_->allocate(n * sizeof(T)));
+	}
+
+	void deallocate(T *p, const size_t n) {
+		pool_->deallocate(p, n * sizeof(T));
+	}
+
+	template <typename U>
+	bool operator==(const PoolAllocator<U> &other) const {
+		return pool_ == other.pool_;
+	}
+
+	template <typename U>
+	bool operator!=(const PoolAllocator<U> &other) const {
+		return pool_ != other.pool_;
+	}
+};
+
+#endif  // TWAP_NODE_POOL_H_
@@ -0,0 +1,638 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_ORDER_BOOK_H_
+#define TWAP_ORDER_BOOK_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <limits>
+#include <map>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "binary_io.h"
+#include "node_pool.h"
+
+// Price point with the number of orders at it, see OrderBook::copy_depth().
+//
+struct PriceLevel {
+	double price;
+	int count;
+};
+
+// Live and peak sizes of the order book, see OrderBook::stats().
+//
+struct OrderBookStats {
+
+	size_t live_orders;
+	size_t peak_orders;
+	size_t price_levels;
+	size_t peak_price_levels;
+
+	// memory allocated by the order->price and price->count maps
+	AllocationStats order_index;
+	AllocationStats price_levels_index;
+
+	void report(std::ostream &out) const {
+		out << "BOOK: " << live_orders << " live orders (peak " << peak_orders << "), "
+			<< price_levels << " price levels (peak " << peak_price_levels << ")" << std::endl;
+		report_allocation(out, "order index", order_index);
+		report_allocation(out, "price levels", price_levels_index);
+	}
+
+private:
+
+	static void report_allocation(std::ostream &out, const char *name, const AllocationStats &stats) {
+		out << "BOOK: " << name << " " << stats.bytes << " bytes (peak " << stats.peak_bytes
+			<< " bytes), " << stats.reserved_bytes << " bytes reserved in "
+			<< stats.allocations << " allocations" << std::endl;
+	}
+};
+
+// Contains current orders and automatically maintains max price.
+//
+// Order->price map contains prices arranged by order id, so that we
+// can find the price of an order when it needs to be erased by id.
+//
+// Price->count map contains the number of orders for each price point.
+// The map is sorted by price, so we can always obtain max price in O(1).
+// When there are no more orders for some price point, it is removed.
+//
+// Important: Using double as a key is generally not a good idea,
+// but it is justified in this case for price->count map because:
+//
+// 1) We are reading the prices from file and do *not* manipulate them
+//    before using as keys. Therefore, for example, if 10.3 price is read,
+//    it will be exactly equal (==) to the double 10.3 read from another line.
+//
+// 2) We are managing an order book, and therefore in realistic conditions
+//    we actually expect to have many orders outstanding at the *same* prices.
+//    Therefore, using order counting will greatly benefit the performance,
+//    as opposed to storing *all* orders in a map by price.
+//
+// 3) Market prices are not infinitely divisible, but instead change by
+//    ticks. Therefore, we can expect to have a *limited* number of price
+//    points around the current mid price. This counting algorithm
+//    will, again, be very effective in such conditions.
+//
+// Both maps allocate their nodes from own NodePool, so that after the
+// peak number of orders (or the capacity given to the constructor) is
+// reached, the order book no longer allocates memory. The pools also
+// count memory, so that stats() can report live and peak number of
+// orders, price levels and bytes.
+//
+// The orders can be saved to a binary snapshot and loaded into another
+// order book, see write() and read(), which restores the same state.
+// A large number of orders (e.g. the start-of-day snapshot) is best
+// loaded with bulk_load(), which builds both maps directly.
+//
+// The pools never shrink by themselves, so after a peak of orders (e.g.
+// a volatile open) the memory can be returned by compaction, which moves
+// the orders into a new map with a pool for the current number of them,
+// a few at a time within a time budget, see compact(). Meanwhile, the
+// orders are looked up in both maps. The price levels are compacted the
+// same way, from the highest price down, so that the levels at and above
+// the last moved price are in the new map, and those below it in the old
+// one. The old pools are then returned to the system a slice at a time.
+// With auto_compact(), the compaction starts when a pool has grown to
+// kShrinkRatio times the live orders (or price levels), and leaves room
+// for twice as many as there are, so that it doesn't start again until
+// many of them are erased again.
+//
+class OrderBook {
+
+public:
+
+	typedef std::map<int, double, std::less<int>,
+		PoolAllocator<std::pair<const int, double> > > OrderPriceMap;
+
+	typedef std::map<double, int, std::less<double>,
+		PoolAllocator<std::pair<const double, int> > > PriceCountMap;
+
+	// pool capacity to live size ratio when auto_compact() starts
+	static const size_t kShrinkRatio = 4;
+
+	// smallest pool (in nodes) which auto_compact() shrinks
+	static const size_t kMinCompactionNodes = 1 << 16;
+
+private:
+
+	// nodes moved between the checks of the time budget
+	static const size_t kCompactionBatch = 16;
+
+	// memory for the nodes of each of the maps
+	NodePool *order_price_pool_;
+	NodePool *price_count_pool_;
+
+	// keeps track of current orders & prices
+	OrderPriceMap *order_price_map_;
+
+	// counts number of orders at each price
+	PriceCountMap *price_count_map_;
+
+	// the orders not yet moved to order_price_map_ by compaction,
+	// and the pool they are in (which is released when it is empty),
+	// or null if compaction is not in progress
+	OrderPriceMap *old_order_price_map_;
+	NodePool *old_order_price_pool_;
+
+	// the price levels below split_price_, which are not yet moved to
+	// price_count_map_ by compaction (all of them until the first one
+	// is, none after the last one is), and their pool, or null
+	PriceCountMap *old_price_count_map_;
+	NodePool *old_price_count_pool_;
+	double split_price_;
+
+	size_t order_capacity_;
+	size_t price_level_capacity_;
+
+	size_t peak_orders_;
+	size_t peak_price_levels_;
+
+	// peak bytes of the pools replaced by compaction
+	size_t order_index_peak_bytes_;
+	size_t price_levels_peak_bytes_;
+
+	// the pools only know the node size when the first node
+	// is allocated, so allocate (and free) one node right away
+	static OrderPriceMap *new_order_price_map(NodePool *pool, const size_t capacity) {
+		pool->reserve(capacity);
+		OrderPriceMap *map = new OrderPriceMap(std::less<int>(), OrderPriceMap::allocator_type(pool));
+		try {
+			map->erase(map->insert(OrderPriceMap::value_type(0, 0.0)).first);
+		} catch (...) {
+			delete map;
+			throw;
+		}
+		return map;
+	}
+
+	static PriceCountMap *new_price_count_map(NodePool *pool, const size_t capacity) {
+		pool->reserve(capacity);
+		PriceCountMap *map = new PriceCountMap(std::less<double>(), PriceCountMap::allocator_type(pool));
+		try {
+			map->erase(map->insert(PriceCountMap::value_type(0.0, 0)).first);
+		} catch (...) {
+			delete map;
+			throw;
+		}
+		return map;
+	}
+
+	static bool should_shrink(const NodePool &pool, const size_t size, const size_t capacity) {
+		return pool.capacity() >= kMinCompactionNodes &&
+			pool.capacity() >= kShrinkRatio * std::max(size, capacity);
+	}
+
+	// the pool would have fewer nodes after compaction
+	static bool would_shrink(const NodePool &pool, const size_t size, const size_t capacity) {
+		return pool.capacity() > std::max(2 * size, capacity);
+	}
+
+	size_t order_count() const {
+		return order_price_map_->size() + (old_order_price_map_ ? old_order_price_map_->size() : 0);
+	}
+
+	size_t price_level_count() const {
+		return price_count_map_->size() + (old_price_count_map_ ? old_price_count_map_->size() : 0);
+	}
+
+	// the map which has (or would have) the price level
+	PriceCountMap *price_levels_of(const double price) const {
+		return old_price_count_map_ && price < split_price_ ? old_price_count_map_ : price_count_map_;
+	}
+
+	// the price level is the highest one, given its map
+	bool is_max_price_level(const PriceCountMap *map, PriceCountMap::iterator it) const {
+		return ++it == map->end() && (map == price_count_map_ || price_count_map_->empty());
+	}
+
+	// the new pool is reserved by the compaction steps
+	void start_order_compaction() {
+		NodePool *pool = new NodePool();
+		OrderPriceMap *map;
+		try {
+			map = new_order_price_map(pool, 0);
+		} catch (...) {
+			delete pool;
+			throw;
+		}
+		pool->reserve_later(std::max(2 * order_price_map_->size(), order_capacity_));
+		old_order_price_map_ = order_price_map_;
+		old_order_price_pool_ = order_price_pool_;
+		order_price_pool_ = pool;
+		order_price_map_ = map;
+	}
+
+	void start_price_level_compaction() {
+		NodePool *pool = new NodePool();
+		PriceCountMap *map;
+		try {
+			map = new_price_count_map(pool, 0);
+		} catch (...) {
+			delete pool;
+			throw;
+		}
+		pool->reserve_later(std::max(2 * price_count_map_->size(), price_level_capacity_));
+		old_price_count_map_ = price_count_map_;
+		old_price_count_pool_ = price_count_pool_;
+		price_count_pool_ = pool;
+		price_count_map_ = map;
+		split_price_ = std::numeric_limits<double>::infinity();
+	}
+
+	// Does the next step of the compaction, which takes bounded time:
+	// maps a chunk of a new pool (of two pages, see NodePool), or moves
+	// kCompactionBatch orders or price levels, or unmaps a page of an old
+	// pool, or deletes the old map and pool which have been released.
+	void compaction_step() {
+		if (old_order_price_map_ && order_price_pool_->reserve_chunk()) {
+			// room for the orders, before they are moved
+		} else if (old_order_price_map_ && !old_order_price_map_->empty()) {
+			OrderPriceMap::iterator hint = order_price_map_->lower_bound(old_order_price_map_->begin()->first);
+			for (size_t i = 0; i < kCompactionBatch && !old_order_price_map_->empty(); i++) {
+				const OrderPriceMap::iterator it = old_order_price_map_->begin();
+				// the orders are moved in order of id, so each one goes
+				// right before the next order after the previous one
+				hint = order_price_map_->insert(hint, *it);
+				++hint;
+				old_order_price_map_->erase(it);
+			}
+		} else if (old_order_price_map_) {
+			if (!old_order_price_pool_->release_slice()) {
+				order_index_peak_bytes_ = std::max(order_index_peak_bytes_, old_order_price_pool_->stats().peak_bytes);
+				delete old_order_price_map_;
+				delete old_order_price_pool_;
+				old_order_price_map_ = 0;
+				old_order_price_pool_ = 0;
+			}
+		} else if (price_count_pool_->reserve_chunk()) {
+			// room for the price levels
+		} else if (!old_price_count_map_->empty()) {
+			for (size_t i = 0; i < kCompactionBatch && !old_price_count_map_->empty(); i++) {
+				const PriceCountMap::iterator it = --old_price_count_map_->end();
+				// the levels are moved from the highest price down,
+				// so each one goes before all the moved ones
+				price_count_map_->insert(price_count_map_->begin(), *it);
+				split_price_ = it->first;
+				old_price_count_map_->erase(it);
+			}
+			if (old_price_count_map_->empty()) {
+				// all the levels are in the new map, and so are the new ones,
+				// so that the old pool is not used while it is released
+				split_price_ = -std::numeric_limits<double>::infinity();
+			}
+		} else if (!old_price_count_pool_->release_slice()) {
+			price_levels_peak_bytes_ = std::max(price_levels_peak_bytes_, old_price_count_pool_->stats().peak_bytes);
+			delete old_price_count_map_;
+			delete old_price_count_pool_;
+			old_price_count_map_ = 0;
+			old_price_count_pool_ = 0;
+		}
+	}
+
+	static AllocationStats add_stats(const AllocationStats &a, const AllocationStats &b) {
+		AllocationStats result;
+		result.bytes = a.bytes + b.bytes;
+		result.peak_bytes = std::max(a.peak_bytes, b.peak_bytes);
+		result.reserved_bytes = a.reserved_bytes + b.reserved_bytes;
+		result.allocations = a.allocations + b.allocations;
+		return result;
+	}
+
+	struct CompareOrderIds {
+		bool operator()(const std::pair<int, double> &a, const std::pair<int, double> &b) const {
+			return a.first < b.first;
+		}
+	};
+
+	struct SameOrderIds {
+		bool operator()(const std::pair<int, double> &a, const std::pair<int, double> &b) const {
+			return a.first == b.first;
+		}
+	};
+
+public:
+
+	// Capacity is the expected max number of orders and price levels,
+	// which is reserved upfront, but the order book can grow beyond it.
+	explicit OrderBook(const size_t order_capacity = 0, const size_t price_level_capacity = 0) {
+		order_price_pool_ = new NodePool();
+		price_count_pool_ = new NodePool();
+		order_price_map_ = new_order_price_map(order_price_pool_, order_capacity);
+		price_count_map_ = new_price_count_map(price_count_pool_, price_level_capacity);
+		old_order_price_map_ = 0;
+		old_order_price_pool_ = 0;
+		old_price_count_map_ = 0;
+		old_price_count_pool_ = 0;
+		split_price_ = 0;
+		order_capacity_ = order_capacity;
+		price_level_capacity_ = price_level_capacity;
+		peak_orders_ = 0;
+		peak_price_levels_ = 0;
+		order_index_peak_bytes_ = 0;
+		price_levels_peak_bytes_ = 0;
+	}
+
+	~OrderBook() {
+		delete order_price_map_;
+		delete price_count_map_;
+		delete old_order_price_map_;
+		delete old_price_count_map_;
+		delete order_price_pool_;
+		delete price_count_pool_;
+		delete old_order_price_pool_;
+		delete old_price_count_pool_;
+	}
+
+	// Returns true if the max price has changed as a result,
+	// which only happens when a new highest price point is added.
+	// If it throws (when memory can't be allocated), the order book
+	// is left unchanged.
+	bool insert_order(const int order_id, const double price) {
+
+		if (old_order_price_map_ && old_order_price_map_->count(order_id) > 0) {
+			return false; // same as below, but the order is not yet moved by compaction
+		}
+
+		const std::pair<OrderPriceMap::iterator, bool> order_pair
+			= order_price_map_->insert(OrderPriceMap::value_type(order_id, price));
+
+		if (order_pair.second == false) {
+			return false; // order with this id already exists, not generating error, as per assumptions
+		}
+
+		// if the price level can't be added (its pool can't grow),
+		// the order is taken out again, so that the book stays the same
+		PriceCountMap *price_count_map = price_levels_of(price);
+		std::pair<PriceCountMap::iterator, bool> price_pair;
+		try {
+			price_pair = price_count_map->insert(PriceCountMap::value_type(price, 1));
+		} catch (...) {
+			order_price_map_->erase(order_pair.first);
+			throw;
+		}
+
+		if (peak_orders_ < order_count()) {
+			peak_orders_ = order_count();
+		}
+
+		if (price_pair.second == false) {
+			price_pair.first->second++; // increment number of orders at this price
+			return false;
+		}
+
+		if (peak_price_levels_ < price_level_count()) {
+			peak_price_levels_ = price_level_count();
+		}
+
+		return is_max_price_level(price_count_map, price_pair.first);
+	}
+
+	// Returns true if the max price has changed as a result,
+	// which only happens when the highest price point is removed.
+	bool erase_order(const int order_id) {
+
+		OrderPriceMap *order_price_map = order_price_map_;
+		OrderPriceMap::iterator order_it = order_price_map->find(order_id);
+
+		if (order_it == order_price_map->end() && old_order_price_map_) {
+			order_price_map = old_order_price_map_; // not yet moved by compaction
+			order_it = order_price_map->find(order_id);
+		}
+
+		if (order_it == order_price_map->end()) {
+			return false; // no order with this id exists, not generating error, as per assumptions
+		}
+
+		const double price = order_it->second;
+
+		order_price_map->erase(order_it);
+
+		PriceCountMap *price_count_map = price_levels_of(price);
+		const PriceCountMap::iterator price_it = price_count_map->find(price);
+
+		price_it->second--; // decrement order count at this price
+
+		if (price_it->second <= 0) {
+			const bool is_max_price = is_max_price_level(price_count_map, price_it);
+			price_count_map->erase(price_it);
+			return is_max_price;
+		}
+
+		return false;
+	}
+
+	double max_price() const {
+		const PriceCountMap *price_count_map = price_count_map_;
+		if (price_count_map->empty() && old_price_count_map_) {
+			price_count_map = old_price_count_map_; // none moved by compaction yet
+		}
+		double result;
+		if (price_count_map->empty()) {
+			result = std::numeric_limits<double>::quiet_NaN();
+		} else {
+			result = price_count_map->rbegin()->first;
+		}
+		return result;
+	}
+
+	// Copies up to max_levels highest price levels into the array,
+	// highest first, and returns the number of levels copied.
+	size_t copy_depth(PriceLevel *levels, const size_t max_levels) const {
+		size_t count = 0;
+		for (PriceCountMap::const_reverse_iterator it = price_count_map_->rbegin();
+			it != price_count_map_->rend() && count < max_levels; ++it, ++count) {
+			levels[count].price = it->first;
+			levels[count].count = it->second;
+		}
+		if (old_price_count_map_) {
+			// below the levels moved by compaction
+			for (PriceCountMap::const_reverse_iterator it = old_price_count_map_->rbegin();
+				it != old_price_count_map_->rend() && count < max_levels; ++it, ++count) {
+				levels[count].price = it->first;
+				levels[count].count = it->second;
+			}
+		}
+		return count;
+	}
+
+	// Adds the orders given as (order id, price), same as insert_order()
+	// for each of them in the given order, but if the order book is empty,
+	// the orders are sorted by id and the prices are sorted and counted
+	// first, and then both maps are built in order, with the nodes for all
+	// of them reserved upfront, and each one inserted at the end, which
+	// takes amortized constant time, instead of searching the tree for it.
+	// The vector is reordered.
+	void bulk_load(std::vector<std::pair<int, double> > &orders) {
+
+		if (order_count() > 0) {
+			for (size_t i = 0; i < orders.size(); i++) {
+				insert_order(orders[i].first, orders[i].second);
+			}
+			return;
+		}
+
+		// the first order with each id is inserted, as per insert_order()
+		std::stable_sort(orders.begin(), orders.end(), CompareOrderIds());
+		orders.erase(std::unique(orders.begin(), orders.end(), SameOrderIds()), orders.end());
+
+		std::vector<double> prices(orders.size());
+		for (size_t i = 0; i < orders.size(); i++) {
+			prices[i] = orders[i].second;
+		}
+		std::sort(prices.begin(), prices.end());
+		size_t price_levels = 0;
+		for (size_t i = 0; i < prices.size(); i++) {
+			price_levels += i == 0 || prices[i] != prices[i - 1];
+		}
+
+		order_price_pool_->reserve(orders.size());
+		price_count_pool_->reserve(price_levels);
+		if (old_price_count_map_) {
+			// the book is empty, so the levels are all in the new map
+			split_price_ = -std::numeric_limits<double>::infinity();
+		}
+
+		for (size_t i = 0; i < orders.size(); i++) {
+			order_price_map_->insert(order_price_map_->end(),
+				OrderPriceMap::value_type(orders[i].first, orders[i].second));
+		}
+		for (size_t i = 0; i < prices.size();) {
+			size_t end = i + 1;
+			while (end < prices.size() && prices[end] == prices[i]) {
+				end++;
+			}
+			price_count_map_->insert(price_count_map_->end(),
+				PriceCountMap::value_type(prices[i], (int)(end - i)));
+			i = end;
+		}
+
+		if (peak_orders_ < order_price_map_->size()) {
+			peak_orders_ = order_price_map_->size();
+		}
+		if (peak_price_levels_ < price_level_count()) {
+			peak_price_levels_ = price_level_count();
+		}
+	}
+
+	// Writes the orders (by id, unless compaction is in progress)
+	// in the native byte order.
+	void write(std::ostream &out) const {
+		write_value<unsigned long long>(out, order_count());
+		for (OrderPriceMap::const_iterator it = order_price_map_->begin(); it != order_price_map_->end(); ++it) {
+			write_value<int>(out, it->first);
+			write_value<double>(out, it->second);
+		}
+		if (old_order_price_map_) {
+			for (OrderPriceMap::const_iterator it = old_order_price_map_->begin(); it != old_order_price_map_->end(); ++it) {
+				write_value<int>(out, it->first);
+				write_value<double>(out, it->second);
+			}
+		}
+	}
+
+	// Adds the orders from the snapshot written by write(), returns false
+	// (and adds none) if the input ends early. Normally used on an empty
+	// book, see bulk_load().
+	bool read(std::istream &in) {
+		unsigned long long count;
+		if (!read_value(in, count)) {
+			return false;
+		}
+		std::vector<std::pair<int, double> > orders;
+		for (unsigned long long i = 0; i < count; i++) {
+			int order_id;
+			double price;
+			if (!read_value(in, order_id) || !read_value(in, price)) {
+				return false;
+			}
+			orders.push_back(std::make_pair(order_id, price));
+		}
+		bulk_load(orders);
+		return true;
+	}
+
+	// Starts the compaction of the orders, and of the price levels, each
+	// one if it is not in progress and its pool would shrink, which is
+	// then continued by compact(). The new pool has room for twice the
+	// live orders (or levels), but not less than the capacity given to
+	// the constructor.
+	void start_compaction() {
+		if (!old_order_price_map_ &&
+			would_shrink(*order_price_pool_, order_price_map_->size(), order_capacity_)) {
+			start_order_compaction();
+		}
+		if (!old_price_count_map_ &&
+			would_shrink(*price_count_pool_, price_count_map_->size(), price_level_capacity_)) {
+			start_price_level_compaction();
+		}
+	}
+
+	bool compacting() const {
+		return old_order_price_map_ != 0 || old_price_count_map_ != 0;
+	}
+
+	// Continues the compaction for about the time budget (or until
+	// it is done, if the budget is negative), and returns true when
+	// the compaction is done (or not in progress). It is done in steps
+	// (see compaction_step()), at least one of them, and the budget is
+	// checked after each one, so that it takes longer than the budget by
+	// at most one step. A step takes a few microseconds (e.g. 2 us to
+	// move a batch, 4-6 us to map or unmap pages, on a virtual machine),
+	// unless the system interrupts it, see test/compaction_latency.cpp.
+	bool compact(const std::chrono::nanoseconds budget = std::chrono::nanoseconds(-1)) {
+		const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + budget;
+		while (compacting()) {
+			compaction_step();
+			if (budget.count() >= 0 && std::chrono::steady_clock::now() >= deadline) {
+				return !compacting();
+			}
+		}
+		return true;
+	}
+
+	// Starts the compaction of the orders (or of the price levels) when
+	// their pool has grown to kShrinkRatio times the live orders (or
+	// levels, and the capacity given to the constructor), and continues
+	// it for the time budget. Meant to be called after each event, it is
+	// cheap when there is nothing to do.
+	void auto_compact(const std::chrono::nanoseconds budget) {
+		if (!old_order_price_map_ &&
+			should_shrink(*order_price_pool_, order_price_map_->size(), order_capacity_)) {
+			start_order_compaction();
+		}
+		if (!old_price_count_map_ &&
+			should_shrink(*price_count_pool_, price_count_map_->size(), price_level_capacity_)) {
+			start_price_level_compaction();
+		}
+		if (compacting()) {
+			compact(budget);
+		}
+	}
+
+	OrderBookStats stats() const {
+		OrderBookStats result;
+		result.live_orders = order_count();
+		result.peak_orders = peak_orders_;
+		result.price_levels = price_level_count();
+		result.peak_price_levels = peak_price_levels_;
+		result.order_index = order_price_pool_->stats();
+		if (old_order_price_pool_) {
+			result.order_index = add_stats(result.order_index, old_order_price_pool_->stats());
+		}
+		result.order_index.peak_bytes = std::max(result.order_index.peak_bytes, order_index_peak_bytes_);
+		result.price_levels_index = price_count_pool_->stats();
+		if (old_price_count_pool_) {
+			result.price_levels_index = add_stats(result.price_levels_index, old_price_count_pool_->stats());
+		}
+		result.price_levels_index.peak_bytes = std::max(result.price_levels_index.peak_bytes, price_levels_peak_bytes_);
+		return result;
+	}
+};
+
+#endif  // TWAP_ORDER_BOOK_H_
@@ -0,0 +1,15 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_ORDER_EVENT_H_
+#define TWAP_ORDER_EVENT_H_
+
+// Order book event, e.g. one line of the input file (see parse_order_event()).
+//
+struct OrderEvent {
+	int time;
+	char operation; // 'I' for insert, 'E' for erase, 0 if unknown
+	int order_id;
+	double price;   // only for insert
+};
+
+#endif  // TWAP_ORDER_EVENT_H_
@@ -0,0 +1,82 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_OUTPUT_WRITER_H_
+#define TWAP_OUTPUT_WRITER_H_
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+// Writes formatted prices to a file through a buffer, which doesn't
+// allocate memory (unlike streams, it only flushes when the buffer
+// is full, or when the writer is destroyed).
+//
+class OutputWriter {
+
+public:
+
+	static const size_t kMaxLineLength = 32;
+
+private:
+
+	FILE *file_;
+	std::vector<char> buffer_;
+	size_t size_;
+	long long lines_;
+
+public:
+
+	explicit OutputWriter(FILE *file, const size_t buffer_size = 1 << 16)
+		: buffer_(buffer_size) {
+		file_ = file;
+		size_ = 0;
+		lines_ = 0;
+	}
+
+	~OutputWriter() {
+		flush();
+	}
+
+	// Formats the line into the buffer of at least kMaxLineLength
+	// bytes, same as operator<< with the default precision, and
+	// returns its length.
+	static size_t format_line(char *buffer, const double value) {
+		return std::snprintf(buffer, kMaxLineLength, "%g\n", value);
+	}
+
+	void write_line(const double value) {
+		if (buffer_.size() - size_ < kMaxLineLength) {
+			flush();
+		}
+		size_ += format_line(&buffer_[size_], value);
+		lines_++;
+	}
+
+	// Writes the already formatted lines.
+	void write(const char *data, const size_t size) {
+		if (buffer_.size() - size_ >= size) {
+			std::copy(data, data + size, &buffer_[size_]);
+			size_ += size;
+		} else {
+			flush();
+			std::fwrite(data, 1, size, file_);
+		}
+		for (size_t i = 0; i < size; i++) {
+			lines_ += data[i] == '\n';
+		}
+	}
+
+	long long lines() const {
+		return lines_;
+	}
+
+	void flush() {
+		if (size_ > 0) {
+			std::fwrite(&buffer_[0], 1, size_, file_);
+			size_ = 0;
+		}
+		std::fflush(file_);
+	}
+};
+
+#endif  // TWAP_OUTPUT_WRITER_H_
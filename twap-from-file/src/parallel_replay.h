@@ -0,0 +1,380 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_PARALLEL_REPLAY_H_
+#define TWAP_PARALLEL_REPLAY_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "input_stream.h"
+#include "line_reader.h"
+#include "order_book.h"
+#include "output_writer.h"
+#include "twap_accumulator.h"
+#include "twap_kernel.h"
+#include "work_stealing_pool.h"
+
+// Replays one input file on several threads, by splitting it into
+// chunks of lines, and giving each chunk the order book it starts with.
+//
+// 1) Each chunk is scanned for its net effect on the book: the orders
+//    inserted in it and still live at its end, and the orders erased
+//    in it, which were inserted before it.
+//
+// 2) The book at the start of each chunk is the book at the start of
+//    the previous one with the effect of that chunk applied, so the
+//    chunks are replayed in order of their index: the thread which takes
+//    the next chunk brings a running book up to it (a prefix over the
+//    effects) and copies it, and then replays the chunk from the copy
+//    into the (time, max price) points on its own.
+//
+// 3) The points of each chunk are summed up in a TwapAccumulator, and
+//    merging them in order (a prefix over the chunks, which is cheap)
+//    gives the state before each chunk, so that as soon as the earlier
+//    chunks are replayed, the chunk can calculate its TWAP with TwapKernel
+//    and format its output on its own. The output of each chunk is written
+//    as soon as it and all earlier chunks are formatted, and then freed.
+//
+// The result is the same as from TwapKernel over the whole file (within
+// rounding, since the sums are added up in a different order), also when
+// the time goes back across the chunks. Order ids must be unique, as per
+// assumptions. Memory is for the effects of the chunks, and the points
+// and the output text of the chunks in progress.
+//
+class ParallelReplay {
+
+private:
+
+	struct Chunk {
+		long long begin; // byte range in the file, at line starts
+		long long end;
+
+		// orders inserted in this chunk, and still live at its end
+		std::unordered_map<int, double> live_orders;
+
+		// orders erased in this chunk, which were inserted before it
+		std::vector<int> erased_orders;
+
+		std::vector<int> times;
+		std::vector<double> prices;
+
+		TwapAccumulator twap;
+		TwapKernel kernel; // state before the chunk
+
+		std::vector<char> text;
+		std::string error;
+
+		bool replayed;
+		bool formatted;
+	};
+
+	std::string file_name_;
+	std::vector<Chunk> chunks_;
+	OutputWriter *output_;
+
+	// the book at the start of the next chunk to replay
+	std::mutex book_mutex_;
+	std::unordered_map<int, double> book_;
+	size_t next_chunk_;
+
+	// the chunks before replay_frontier_ are replayed and merged into
+	// twap_, and the chunks before write_frontier_ are written
+	std::mutex output_mutex_;
+	TwapAccumulator twap_;
+	TwapKernel start_kernel_;
+	size_t replay_frontier_;
+	size_t write_frontier_;
+
+	// calls function(event) for each event in the chunk
+	template <typename Function>
+	bool for_each_event(Chunk &chunk, Function &function) {
+		FILE *file = std::fopen(file_name_.c_str(), "rb");
+		if (!file || fseeko(file, chunk.begin, SEEK_SET) != 0) {
+			chunk.error = "can't read input file";
+			if (file) {
+				std::fclose(file);
+			}
+			return false;
+		}
+		FileInputStream input(file);
+		LineReader line_reader(input);
+		char *line;
+		char *line_end;
+		while (chunk.begin + line_reader.offset() < chunk.end &&
+			line_reader.next_line(line, line_end)) {
+			OrderEvent event;
+			if (parse_order_event(line, event)) {
+				function(event);
+			}
+		}
+		std::fclose(file);
+		return true;
+	}
+
+	struct FindEffect {
+		Chunk &chunk;
+		void operator()(const OrderEvent &event) const {
+			if (event.operation == 'I') {
+				chunk.live_orders.insert(std::make_pair(event.order_id, event.price));
+			} else if (event.operation == 'E') {
+				if (chunk.live_orders.erase(event.order_id) == 0) {
+					chunk.erased_orders.push_back(event.order_id);
+				}
+			}
+		}
+	};
+
+	struct Replay {
+		Chunk &chunk;
+		OrderBook &order_book;
+		bool max_price_changed;
+		double max_price;
+		void operator()(const OrderEvent &event) {
+			if (event.operation == 'I') {
+				max_price_changed |= order_book.insert_order(event.order_id, event.price);
+			} else if (event.operation == 'E') {
+				max_price_changed |= order_book.erase_order(event.order_id);
+			}
+			if (max_price_changed) {
+				max_price = order_book.max_price();
+				max_price_changed = false;
+			}
+			chunk.times.push_back(event.time);
+			chunk.prices.push_back(max_price);
+		}
+	};
+
+	void find_effect(const size_t index) {
+		if (index + 1 == chunks_.size()) {
+			return; // no chunks after the last one need its effect
+		}
+		FindEffect find_effect = { chunks_[index] };
+		for_each_event(chunks_[index], find_effect);
+	}
+
+	// takes the next chunk in order, with a copy of the book at its start
+	size_t take_chunk(std::vector<std::pair<int, double> > &orders) {
+		std::lock_guard<std::mutex> lock(book_mutex_);
+		const size_t index = next_chunk_++;
+		if (index > 0) {
+			Chunk &previous = chunks_[index - 1];
+			for (size_t i = 0; i < previous.erased_orders.size(); i++) {
+				book_.erase(previous.erased_orders[i]);
+			}
+			book_.insert(previous.live_orders.begin(), previous.live_orders.end());
+			std::vector<int>().swap(previous.erased_orders);
+			std::unordered_map<int, double>().swap(previous.live_orders);
+		}
+		orders.assign(book_.begin(), book_.end());
+		return index;
+	}
+
+	void replay(Chunk &chunk, std::vector<std::pair<int, double> > &orders) {
+		OrderBook order_book;
+		order_book.bulk_load(orders);
+		std::vector<std::pair<int, double> >().swap(orders);
+		Replay replay = { chunk, order_book, false, order_book.max_price() };
+		for_each_event(chunk, replay);
+
+		// same order of additions as in TwapKernel
+		for (size_t i = 0; i < chunk.times.size(); i++) {
+			chunk.twap.next_price(chunk.times[i], chunk.prices[i]);
+		}
+	}
+
+	// runs the kernel over the chunk and formats its output
+	static void format_output(Chunk &chunk, TwapKernel &kernel) {
+		static const size_t kBlockSize = 4096;
+		std::vector<double> avg_prices(kBlockSize);
+		size_t size = 0;
+		for (size_t begin = 0; begin < chunk.times.size(); begin += kBlockSize) {
+			const size_t count = std::min(kBlockSize, chunk.times.size() - begin);
+			kernel.run(&chunk.times[begin], &chunk.prices[begin], count, &avg_prices[0]);
+			chunk.text.resize(size + count * OutputWriter::kMaxLineLength);
+			for (size_t i = 0; i < count; i++) {
+				if (!std::isnan(avg_prices[i])) {
+					size += OutputWriter::format_line(&chunk.text[size], avg_prices[i]);
+				}
+			}
+		}
+		chunk.text.resize(size);
+		std::vector<int>().swap(chunk.times);
+		std::vector<double>().swap(chunk.prices);
+	}
+
+	// appends the chunk to twap_, see run()
+	void merge_twap(const Chunk &chunk) {
+		if (!twap_.empty() && !chunk.twap.empty() && !std::isnan(twap_.last_price()) &&
+			chunk.twap.first_time() < twap_.last_time()) {
+			// the chunk starts before the last point of the earlier ones,
+			// so some of its points are dropped, which its accumulator
+			// couldn't know, and they are added one at a time instead
+			for (size_t i = 0; i < chunk.times.size(); i++) {
+				twap_.next_price(chunk.times[i], chunk.prices[i]);
+			}
+		} else {
+			twap_.merge(chunk.twap);
+		}
+	}
+
+	// writes the formatted chunks which are next in order, under the lock,
+	// and stops at the first chunk that has failed
+	void write_chunks() {
+		while (write_frontier_ < chunks_.size() && chunks_[write_frontier_].formatted &&
+			chunks_[write_frontier_].error.empty()) {
+			std::vector<char> &text = chunks_[write_frontier_].text;
+			if (!text.empty()) {
+				output_->write(&text[0], text.size());
+			}
+			std::vector<char>().swap(text);
+			write_frontier_++;
+		}
+	}
+
+	// replays the next chunk, and formats and writes the chunks
+	// which then have all the earlier chunks replayed
+	void replay_next_chunk(size_t) {
+		std::vector<std::pair<int, double> > orders;
+		const size_t index = take_chunk(orders);
+		replay(chunks_[index], orders);
+
+		std::vector<size_t> ready;
+		{
+			std::lock_guard<std::mutex> lock(output_mutex_);
+			chunks_[index].replayed = true;
+			for (; replay_frontier_ < chunks_.size() && chunks_[replay_frontier_].replayed; replay_frontier_++) {
+				Chunk &chunk = chunks_[replay_frontier_];
+				if (twap_.covered_time() <= 0) {
+					// until some time has passed with a price, TwapKernel
+					// needs to see all the points from the start
+					merge_twap(chunk);
+					format_output(chunk, start_kernel_);
+					chunk.formatted = true;
+				} else {
+					// the kernel adds the segment between the last point
+					// of the previous chunk and its first point itself
+					chunk.kernel = TwapKernel(twap_.price_time(), twap_.covered_time(),
+						twap_.last_time(), twap_.last_price());
+					merge_twap(chunk);
+					ready.push_back(replay_frontier_);
+				}
+			}
+			write_chunks();
+		}
+
+		for (size_t i = 0; i < ready.size(); i++) {
+			format_output(chunks_[ready[i]], chunks_[ready[i]].kernel);
+			std::lock_guard<std::mutex> lock(output_mutex_);
+			chunks_[ready[i]].formatted = true;
+			write_chunks();
+		}
+	}
+
+	struct Phase {
+		ParallelReplay &replay;
+		void (ParallelReplay::*function)(size_t);
+		void operator()(const size_t index) const {
+			(replay.*function)(index);
+		}
+	};
+
+	void run_phase(WorkStealingPool &pool, void (ParallelReplay::*function)(size_t)) {
+		std::vector<size_t> order(chunks_.size());
+		for (size_t i = 0; i < order.size(); i++) {
+			order[i] = i;
+		}
+		const Phase phase = { *this, function };
+		pool.run(order, phase);
+	}
+
+	ParallelReplay(const ParallelReplay &);
+	ParallelReplay &operator=(const ParallelReplay &);
+
+public:
+
+	explicit ParallelReplay(const std::string &file_name) : file_name_(file_name) {
+		output_ = 0;
+		next_chunk_ = 0;
+		replay_frontier_ = 0;
+		write_frontier_ = 0;
+	}
+
+	// Starts the replay with the orders (e.g. the start-of-day snapshot),
+	// keeping the first of any duplicate id, as OrderBook::bulk_load().
+	void set_initial_book(const std::vector<std::pair<int, double> > &orders) {
+		book_.clear();
+		book_.insert(orders.begin(), orders.end());
+	}
+
+	// Replays the file split into chunk_count chunks on the threads, and
+	// writes TWAP after each event to the output. Returns false and sets
+	// error if the file can't be read.
+	bool run(const size_t chunk_count, const size_t thread_count,
+			OutputWriter &output, std::string &error) {
+
+		FILE *file = std::fopen(file_name_.c_str(), "rb");
+		if (!file) {
+			error = "can't access input file";
+			return false;
+		}
+		std::string input_error;
+		InputStream *input = open_input_stream(file, input_error);
+		const bool compressed = !input || input->compressed();
+		delete input;
+		if (compressed) {
+			error = "compressed input can't be split into chunks";
+			std::fclose(file);
+			return false;
+		}
+
+		// chunk boundaries at the starts of the lines
+		fseeko(file, 0, SEEK_END);
+		const long long size = ftello(file);
+		chunks_.resize(chunk_count > 0 ? chunk_count : 1);
+		long long begin = 0;
+		for (size_t i = 0; i < chunks_.size(); i++) {
+			long long end = size * (long long)(i + 1) / (long long)chunks_.size();
+			if (end < begin) {
+				end = begin;
+			}
+			if (end > 0 && end < size) {
+				fseeko(file, end - 1, SEEK_SET);
+				int c;
+				while ((c = std::fgetc(file)) != EOF && c != '\n') {
+					end++;
+				}
+			}
+			chunks_[i].begin = begin;
+			chunks_[i].end = end;
+			chunks_[i].replayed = false;
+			chunks_[i].formatted = false;
+			begin = end;
+		}
+		std::fclose(file);
+
+		WorkStealingPool pool(thread_count);
+		output_ = &output;
+
+		run_phase(pool, &ParallelReplay::find_effect);
+
+		// each task takes the next chunk in order, see take_chunk()
+		run_phase(pool, &ParallelReplay::replay_next_chunk);
+
+		for (size_t i = 0; i < chunks_.size(); i++) {
+			if (!chunks_[i].error.empty()) {
+				error = chunks_[i].error;
+				return false;
+			}
+		}
+		output.flush();
+		return true;
+	}
+};
+
+#endif  // TWAP_PARALLEL_REPLAY_H_
@@ -0,0 +1,376 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_PROFILER_H_
+#define TWAP_PROFILER_H_
+
+#include <cctype>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+// Reads a fast monotonic tick counter.
+//
+// On x86 this is the CPU time stamp counter (rdtsc), which costs
+// a few nanoseconds to read, on other platforms the steady clock
+// in nanoseconds. Ticks are converted to nanoseconds by measuring
+// how many of them have passed during a known steady clock period,
+// so the conversion is only accurate over longer periods of time.
+//
+class CycleClock {
+
+private:
+
+	unsigned long long start_ticks_;
+	std::chrono::steady_clock::time_point start_time_;
+
+public:
+
+	static unsigned long long now() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	CycleClock() {
+		start_ticks_ = now();
+		start_time_ = std::chrono::steady_clock::now();
+	}
+
+	// nanoseconds elapsed since construction
+	double elapsed_ns() const {
+		return std::chrono::duration<double, std::nano>(
+			std::chrono::steady_clock::now() - start_time_).count();
+	}
+
+	// calibrated using the period elapsed since construction
+	double ns_per_tick() const {
+		const unsigned long long ticks = now() - start_ticks_;
+		return ticks > 0 ? elapsed_ns() / ticks : 0.0;
+	}
+
+	// calibrated by spinning for the given period, to be used
+	// when the ticks need to be converted on the fly
+	static double measure_ns_per_tick(const double period_ns = 1e7) {
+		const CycleClock clock;
+		while (clock.elapsed_ns() < period_ns) {
+		}
+		return clock.ns_per_tick();
+	}
+};
+
+// Reads a group of hardware performance counters (cycles, instructions,
+// L1D and LLC misses, branch misses) and accumulates their increments
+// for each stage of the processing loop, same as Profiler does for time.
+//
+// Counters are opened with perf_event_open() for user space only, as one
+// group, so that they are always scheduled together and read with one
+// read() call. The read itself is a system call, so this makes the whole
+// program much slower, but it is excluded from the user space counts.
+//
+// If the kernel doesn't allow counters (e.g. perf_event_paranoid is too
+// high, or running in a container or VM), enable() returns false and
+// the reason is reported instead. Counters not supported by the CPU are
+// skipped individually.
+//
+class PerfCounters {
+
+public:
+
+	enum Counter {
+		kCycles,
+		kInstructions,
+		kL1DMisses,
+		kLLCMisses,
+		kBranchMisses,
+		kCounterCount
+	};
+
+private:
+
+	int stage_count_;
+	int leader_fd_;
+	int fds_[kCounterCount];
+	int group_index_[kCounterCount]; // position in the group read, or -1
+	int group_size_;
+	unsigned long long last_values_[kCounterCount];
+	std::vector<unsigned long long> stage_values_;
+	std::string error_;
+
+#ifdef __linux__
+	static int open_counter(const unsigned int type, const unsigned long long config, const int group_fd) {
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = group_fd == -1 ? 1 : 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+	}
+#endif
+
+	bool read_values(unsigned long long values[kCounterCount]) {
+#ifdef __linux__
+		unsigned long long buffer[1 + kCounterCount];
+		if (read(leader_fd_, buffer, sizeof(buffer)) < (ssize_t)sizeof(unsigned long long)) {
+			return false;
+		}
+		for (int i = 0; i < kCounterCount; i++) {
+			values[i] = group_index_[i] >= 0 ? buffer[1 + group_index_[i]] : 0;
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
+
+public:
+
+	explicit PerfCounters(const int stage_count)
+		: stage_values_(stage_count * kCounterCount, 0) {
+		stage_count_ = stage_count;
+		leader_fd_ = -1;
+		group_size_ = 0;
+		for (int i = 0; i < kCounterCount; i++) {
+			fds_[i] = -1;
+			group_index_[i] = -1;
+			last_values_[i] = 0;
+		}
+		error_ = "not enabled";
+	}
+
+	~PerfCounters() {
+#ifdef __linux__
+		for (int i = 0; i < kCounterCount; i++) {
+			if (fds_[i] >= 0) {
+				close(fds_[i]);
+			}
+		}
+#endif
+	}
+
+	bool enable() {
+#ifdef __linux__
+		static const unsigned int types[kCounterCount] = {
+			PERF_TYPE_HARDWARE,
+			PERF_TYPE_HARDWARE,
+			PERF_TYPE_HW_CACHE,
+			PERF_TYPE_HARDWARE,
+			PERF_TYPE_HARDWARE
+		};
+		static const unsigned long long configs[kCounterCount] = {
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_L1D
+				| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+				| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES
+		};
+		for (int i = 0; i < kCounterCount; i++) {
+			fds_[i] = open_counter(types[i], configs[i], leader_fd_);
+			if (fds_[i] < 0) {
+				if (leader_fd_ < 0) {
+					error_ = std::strerror(errno);
+					return false; // cycles must be available
+				}
+				continue; // this one is not supported, skip it
+			}
+			if (leader_fd_ < 0) {
+				leader_fd_ = fds_[i];
+			}
+			group_index_[i] = group_size_++;
+		}
+		ioctl(leader_fd_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(leader_fd_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		if (!read_values(last_values_)) {
+			error_ = "can't read counters";
+			return false;
+		}
+		error_.clear();
+		return true;
+#else
+		error_ = "only supported on Linux";
+		return false;
+#endif
+	}
+
+	bool enabled() const {
+		return error_.empty();
+	}
+
+	void mark(const int stage) {
+		unsigned long long values[kCounterCount];
+		if (!read_values(values)) {
+			return;
+		}
+		unsigned long long *stage_values = &stage_values_[stage * kCounterCount];
+		for (int i = 0; i < kCounterCount; i++) {
+			stage_values[i] += values[i] - last_values_[i];
+			last_values_[i] = values[i];
+		}
+	}
+
+	void report(std::ostream &out, const char *const stage_names[], const long events) const {
+
+		if (!enabled()) {
+			out << "PERF: hardware counters unavailable: " << error_ << std::endl;
+			return;
+		}
+
+		static const char *const counter_names[kCounterCount] = {
+			"cycles", "instructions", "L1D misses", "LLC misses", "branch misses"
+		};
+
+		const double events_count = events > 0 ? events : 1;
+
+		out << "PERF: " << std::setw(12) << "per event";
+		for (int i = 0; i < kCounterCount; i++) {
+			out << std::setw(15) << counter_names[i];
+		}
+		out << std::endl;
+
+		for (int stage = 0; stage < stage_count_; stage++) {
+			out << "PERF: " << std::left << std::setw(12) << stage_names[stage] << std::right;
+			for (int i = 0; i < kCounterCount; i++) {
+				if (group_index_[i] >= 0) {
+					out << std::setw(15) << stage_values_[stage * kCounterCount + i] / events_count;
+				} else {
+					out << std::setw(15) << "n/a";
+				}
+			}
+			out << std::endl;
+		}
+	}
+};
+
+// Accumulates time spent in each stage of the processing loop.
+//
+// The loop calls mark() at the end of each stage, which attributes
+// all ticks since the previous mark() to this stage. Therefore,
+// profiling costs one tick counter read per stage, and all of the
+// loop time is attributed to some stage (e.g., reading the line
+// from the file is attributed to parsing).
+//
+class Profiler {
+
+public:
+
+	enum Stage {
+		kParse,
+		kBookUpdate,
+		kMaxPrice,
+		kTwapUpdate,
+		kOutput,
+		kStageCount
+	};
+
+private:
+
+	CycleClock clock_;
+	PerfCounters perf_counters_;
+	bool perf_counters_requested_;
+	unsigned long long last_ticks_;
+	unsigned long long stage_ticks_[kStageCount];
+	long events_;
+	long malformed_lines_;
+	long skipped_lines_;
+
+public:
+
+	Profiler() : perf_counters_(kStageCount) {
+		perf_counters_requested_ = false;
+		last_ticks_ = CycleClock::now();
+		for (int i = 0; i < kStageCount; i++) {
+			stage_ticks_[i] = 0;
+		}
+		events_ = 0;
+		malformed_lines_ = 0;
+		skipped_lines_ = 0;
+	}
+
+	// also reads hardware counters for each stage, if possible
+	void enable_perf_counters() {
+		perf_counters_requested_ = true;
+		perf_counters_.enable();
+		last_ticks_ = CycleClock::now();
+	}
+
+	void mark(const Stage stage) {
+		if (perf_counters_.enabled()) {
+			perf_counters_.mark(stage);
+		}
+		const unsigned long long ticks = CycleClock::now();
+		stage_ticks_[stage] += ticks - last_ticks_;
+		last_ticks_ = ticks;
+	}
+
+	void count_event() {
+		events_++;
+	}
+
+	// blank lines are skipped, other lines we failed to parse are malformed
+	void count_unparsed_line(const char *line) {
+		while (std::isspace((unsigned char)*line)) {
+			line++;
+		}
+		if (*line == '\0') {
+			skipped_lines_++;
+		} else {
+			malformed_lines_++;
+		}
+	}
+
+	// lines with unknown operations are skipped
+	void count_skipped_line() {
+		skipped_lines_++;
+	}
+
+	void report(std::ostream &out) const {
+
+		static const char *const stage_names[kStageCount] = {
+			"parse", "book update", "max price", "twap update", "output"
+		};
+
+		const double total_ns = clock_.elapsed_ns();
+		const double ns_per_tick = clock_.ns_per_tick();
+		const double events = events_ > 0 ? events_ : 1;
+
+		out << "PROFILE: " << events_ << " events in "
+			<< std::fixed << std::setprecision(3) << total_ns / 1e9 << " sec, "
+			<< std::setprecision(0) << events_ / (total_ns / 1e9) << " events/sec, "
+			<< std::setprecision(1) << total_ns / events << " ns/event" << std::endl;
+
+		for (int i = 0; i < kStageCount; i++) {
+			out << "PROFILE:   " << std::left << std::setw(12) << stage_names[i] << std::right
+				<< std::setw(10) << stage_ticks_[i] * ns_per_tick / events << " ns/event" << std::endl;
+		}
+
+		out << "PROFILE: " << malformed_lines_ << " malformed lines, "
+			<< skipped_lines_ << " skipped lines" << std::endl;
+
+		if (perf_counters_requested_) {
+			perf_counters_.report(out, stage_names, events_);
+		}
+	}
+};
+
+#endif  // TWAP_PROFILER_H_
@@ -0,0 +1,427 @@
+// Using Google C++ coding style
+
+#include "modes.h"
+
+#include <cstdio>
+#include <fstream>
+using namespace std;
+
+#include "time_index.h"
+#include "twap_accumulator.h"
+#include "twap_series.h"
+
+// Adds a snapshot of the order book to the index every interval events,
+// see run_build_index().
+//
+class IndexReplay : public ReplayHandler {
+
+private:
+
+	const FileEventSource &source_;
+	TimeIndexWriter &index_;
+	long interval_;
+	long events_since_snapshot_;
+	bool has_time_;
+	int last_time_;
+
+public:
+
+	IndexReplay(const FileEventSource &source, TimeIndexWriter &index, const long interval)
+		: source_(source), index_(index) {
+		interval_ = interval;
+		events_since_snapshot_ = 0;
+		has_time_ = false;
+		last_time_ = 0;
+	}
+
+	bool before(const OrderEvent &event, const OrderBook &order_book, bool &) {
+		// only between the events with different times, so that
+		// the replay can start with all events at the time
+		if (events_since_snapshot_ >= interval_ && has_time_ && event.time != last_time_) {
+			index_.add(event.time, source_.event_offset(), order_book);
+			events_since_snapshot_ = 0;
+		}
+		return true;
+	}
+
+	void after(const OrderEvent &event, OrderBook &, bool &) {
+		events_since_snapshot_++;
+		has_time_ = true;
+		last_time_ = event.time;
+	}
+};
+
+int run_build_index(const string &file_name, const string &index_file_name, const long interval,
+		const Options &options) {
+
+	FILE *input_file = fopen(file_name.c_str(), "rb");
+
+	if (!input_file) {
+		cerr << "ERROR: Can't access input file: " << file_name << endl;
+		return 1;
+	}
+
+	string error;
+	InputStream *input = open_input_stream(input_file, error);
+	if (!input || input->compressed()) {
+		cerr << "ERROR: Can't index input file " << file_name << ": "
+			 << (input ? "compressed input can't be indexed" : error) << endl;
+		delete input;
+		fclose(input_file);
+		return 1;
+	}
+
+	TimeIndexWriter index;
+	if (!index.create(index_file_name)) {
+		cerr << "ERROR: Can't create index file: " << index_file_name << endl;
+		delete input;
+		fclose(input_file);
+		return 1;
+	}
+
+	OrderBook order_book(options.order_capacity, options.level_capacity);
+	FileEventSource source(*input);
+	IndexReplay index_replay(source, index, interval);
+	if (!replay_events(source, options, order_book, index_replay)) {
+		delete input;
+		fclose(input_file);
+		return 1;
+	}
+
+	const long long input_size = source.offset();
+	const bool ok = index.finish(input_size);
+	delete input;
+	fclose(input_file);
+	if (!ok) {
+		cerr << "ERROR: Can't write index file: " << index_file_name << endl;
+		return 1;
+	}
+	cerr << "INDEX: " << index.entry_count() << " snapshots for "
+		 << input_size << " bytes of input" << endl;
+	return 0;
+}
+
+// Calculates TWAP over the time range during the replay, which stops
+// at the end of the range, see run_range_query().
+//
+class RangeReplay : public ReplayHandler {
+
+private:
+
+	int begin_time_;
+	int end_time_;
+	bool started_;
+	TWAP twap_;
+
+public:
+
+	RangeReplay(const int begin_time, const int end_time) {
+		begin_time_ = begin_time;
+		end_time_ = end_time;
+		started_ = false;
+	}
+
+	bool before(const OrderEvent &event, const OrderBook &order_book, bool &max_price_changed) {
+		if (!started_ && event.time > begin_time_) {
+			twap_.next_price(begin_time_, order_book.max_price());
+			max_price_changed = false;
+			started_ = true;
+		}
+		return !started_ || event.time < end_time_;
+	}
+
+	void after(const OrderEvent &event, OrderBook &order_book, bool &max_price_changed) {
+		// kept until accepted, as in update_twap()
+		if (started_ && max_price_changed && twap_.next_price(event.time, order_book.max_price())) {
+			max_price_changed = false;
+		}
+	}
+
+	void finish(const OrderBook &order_book, bool &) {
+		if (!started_) {
+			twap_.next_price(begin_time_, order_book.max_price());
+		}
+		twap_.next_time(end_time_);
+	}
+
+	double avg_price() const {
+		return twap_.avg_price();
+	}
+};
+
+int run_range_query(const string &file_name, const string &index_file_name,
+		const int begin_time, const int end_time, const Options &options) {
+
+	if (end_time < begin_time) {
+		cerr << "ERROR: Time range ends before it begins." << endl;
+		return 1;
+	}
+
+	FILE *input_file = fopen(file_name.c_str(), "rb");
+
+	if (!input_file) {
+		cerr << "ERROR: Can't access input file: " << file_name << endl;
+		return 1;
+	}
+
+	OrderBook order_book(options.order_capacity, options.level_capacity);
+	Options replay_options = options;
+	long long input_offset = 0;
+
+	if (!index_file_name.empty()) {
+		TimeIndex index;
+		string error;
+		if (!index.open(index_file_name, error)) {
+			cerr << "ERROR: Can't read index file " << index_file_name << ": " << error << endl;
+			fclose(input_file);
+			return 1;
+		}
+		fseeko(input_file, 0, SEEK_END);
+		if (ftello(input_file) != index.input_size()) {
+			cerr << "ERROR: Index file " << index_file_name << " was built for another input file." << endl;
+			fclose(input_file);
+			return 1;
+		}
+		const TimeIndex::Entry *entry = index.find(begin_time);
+		if (entry) {
+			if (!index.read_snapshot(*entry, order_book)) {
+				cerr << "ERROR: Can't read snapshot from index file: " << index_file_name << endl;
+				fclose(input_file);
+				return 1;
+			}
+			input_offset = entry->input_offset;
+			replay_options.initial_book_file_name.clear(); // already in the snapshot
+		}
+		fseeko(input_file, 0, SEEK_SET);
+	}
+
+	string error;
+	InputStream *input = open_input_stream(input_file, error);
+	if (!input || (!index_file_name.empty() && input->compressed())) {
+		cerr << "ERROR: Can't read input file " << file_name << ": "
+			 << (input ? "compressed input can't be indexed" : error) << endl;
+		delete input;
+		fclose(input_file);
+		return 1;
+	}
+	if (input_offset > 0) {
+		// the offsets of the index are in the plain text
+		delete input;
+		fseeko(input_file, input_offset, SEEK_SET);
+		input = new FileInputStream(input_file);
+	}
+
+	FileEventSource source(*input);
+	RangeReplay range_replay(begin_time, end_time);
+	if (!replay_events(source, replay_options, order_book, range_replay)) {
+		delete input;
+		fclose(input_file);
+		return 1;
+	}
+
+	if (!input->error().empty()) {
+		cerr << "ERROR: Can't read input file " << file_name << ": " << input->error() << endl;
+		delete input;
+		fclose(input_file);
+		return 1;
+	}
+	delete input;
+	fclose(input_file);
+	cout << range_replay.avg_price() << endl;
+	return 0;
+}
+
+// Adds the max price to the series after each event, see run_twap_queries().
+//
+class SeriesReplay : public ReplayHandler {
+
+private:
+
+	TwapSeries &series_;
+
+public:
+
+	explicit SeriesReplay(TwapSeries &series) : series_(series) {
+	}
+
+	void after(const OrderEvent &event, OrderBook &order_book, bool &max_price_changed) {
+		if (max_price_changed && series_.add(event.time, order_book.max_price())) {
+			max_price_changed = false;
+		}
+	}
+};
+
+int run_twap_queries(const string &file_name, const string &query_file_name,
+		const Options &options) {
+
+	FILE *input_file = fopen(file_name.c_str(), "rb");
+
+	if (!input_file) {
+		cerr << "ERROR: Can't access input file: " << file_name << endl;
+		return 1;
+	}
+
+	string error;
+	InputStream *input = open_input_stream(input_file, error);
+	if (!input) {
+		cerr << "ERROR: Can't read input file " << file_name << ": " << error << endl;
+		fclose(input_file);
+		return 1;
+	}
+
+	OrderBook order_book(options.order_capacity, options.level_capacity);
+	TwapSeries series;
+	bool ok;
+	{
+		FileEventSource source(*input);
+		SeriesReplay series_replay(series);
+		ok = replay_events(source, options, order_book, series_replay);
+	}
+	error = input->error();
+	delete input;
+	fclose(input_file);
+	if (!ok) {
+		return 1;
+	}
+	if (!error.empty()) {
+		cerr << "ERROR: Can't read input file " << file_name << ": " << error << endl;
+		return 1;
+	}
+
+	FILE *query_file = fopen(query_file_name.c_str(), "rb");
+
+	if (!query_file) {
+		cerr << "ERROR: Can't access query file: " << query_file_name << endl;
+		return 1;
+	}
+
+	FileInputStream query_input(query_file);
+	LineReader query_reader(query_input);
+	OutputWriter output(stdout);
+	long line_number = 0;
+	char *line;
+	char *line_end;
+	while (query_reader.next_line(line, line_end)) {
+		line_number++;
+		const char *pos = line;
+		int begin_time;
+		int end_time;
+		if (!parse_int(pos, begin_time) || !parse_int(pos, end_time)) {
+			output.flush();
+			cerr << "ERROR: Malformed query on line " << line_number << " of " << query_file_name << endl;
+			fclose(query_file);
+			return 1;
+		}
+		output.write_line(series.twap(begin_time, end_time));
+	}
+	output.flush();
+	fclose(query_file);
+	return 0;
+}
+
+// Prints the accumulated TWAP as "twap first_time last_time covered_time".
+//
+static void print_accumulator(const TwapAccumulator &twap) {
+	cout << twap.avg_price() << " " << twap.first_time() << " "
+		 << twap.last_time() << " " << (long long)twap.covered_time() << endl;
+}
+
+// Adds the max price to the accumulator after each event, see run_accumulate().
+//
+class AccumulatorReplay : public ReplayHandler {
+
+private:
+
+	TwapAccumulator &twap_;
+
+public:
+
+	explicit AccumulatorReplay(TwapAccumulator &twap) : twap_(twap) {
+	}
+
+	void after(const OrderEvent &event, OrderBook &order_book, bool &max_price_changed) {
+		if (max_price_changed && twap_.next_price(event.time, order_book.max_price())) {
+			max_price_changed = false;
+		}
+	}
+};
+
+int run_accumulate(const string &file_name, const string &state_file_name,
+		const bool has_session_end, const int session_end_time, const Options &options) {
+
+	FILE *input_file = fopen(file_name.c_str(), "rb");
+
+	if (!input_file) {
+		cerr << "ERROR: Can't access input file: " << file_name << endl;
+		return 1;
+	}
+
+	string error;
+	InputStream *input = open_input_stream(input_file, error);
+	if (!input) {
+		cerr << "ERROR: Can't read input file " << file_name << ": " << error << endl;
+		fclose(input_file);
+		return 1;
+	}
+
+	OrderBook order_book(options.order_capacity, options.level_capacity);
+	TwapAccumulator twap;
+	bool ok;
+	{
+		FileEventSource source(*input);
+		AccumulatorReplay accumulator_replay(twap);
+		ok = replay_events(source, options, order_book, accumulator_replay);
+	}
+	error = input->error();
+	delete input;
+	fclose(input_file);
+	if (!ok) {
+		return 1;
+	}
+	if (!error.empty()) {
+		cerr << "ERROR: Can't read input file " << file_name << ": " << error << endl;
+		return 1;
+	}
+	if (has_session_end) {
+		twap.close(session_end_time);
+	}
+
+	ofstream state_file(state_file_name.c_str(), ios::binary);
+	twap.write(state_file);
+	if (!state_file.good()) {
+		cerr << "ERROR: Can't write TWAP state to file: " << state_file_name << endl;
+		return 1;
+	}
+	print_accumulator(twap);
+	return 0;
+}
+
+int run_merge_states(const vector<string> &file_names, const string &out_file_name) {
+
+	if (file_names.empty()) {
+		cerr << "ERROR: Please specify TWAP state files as arguments." << endl;
+		return 1;
+	}
+
+	TwapAccumulator twap;
+	for (size_t i = 0; i < file_names.size(); i++) {
+		ifstream state_file(file_names[i].c_str(), ios::binary);
+		TwapAccumulator part;
+		if (!part.read(state_file)) {
+			cerr << "ERROR: Can't read TWAP state from file: " << file_names[i] << endl;
+			return 1;
+		}
+		twap.merge(part);
+	}
+
+	if (!out_file_name.empty()) {
+		ofstream out_file(out_file_name.c_str(), ios::binary);
+		twap.write(out_file);
+		if (!out_file.good()) {
+			cerr << "ERROR: Can't write TWAP state to file: " << out_file_name << endl;
+			return 1;
+		}
+	}
+	print_accumulator(twap);
+	return 0;
+}
@@ -0,0 +1,127 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_REORDER_BUFFER_H_
+#define TWAP_REORDER_BUFFER_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "order_event.h"
+
+// Puts back into time order the events that arrive slightly out of
+// order (e.g. when the capture reorders packets by a few milliseconds),
+// since TWAP ignores the time going back.
+//
+// The events are held until an event with the time more than horizon
+// later arrives, so that the events up to horizon late still take their
+// place in time order. The events with the same time keep their order
+// of arrival. The events arriving later than that are passed on right
+// away (out of order, as without the buffer) and counted.
+//
+// The held events are kept in a calendar queue: a ring of buckets, one
+// for each time within the horizon, so that adding an event and taking
+// it out in time order costs O(1), plus one step for each millisecond
+// passed while some events are held. The buckets keep their memory, so
+// after warm-up the buffer doesn't allocate memory.
+//
+class ReorderBuffer {
+
+private:
+
+	int horizon_;
+	size_t mask_;
+	std::vector<std::vector<OrderEvent> > buckets_; // by time modulo their number
+	size_t held_count_;
+	bool started_;
+	int max_time_;
+	int release_time_; // the events before this time have been released
+
+	std::vector<OrderEvent> ready_;
+	size_t ready_index_;
+
+	long long late_events_;
+
+	// releases the held events before the time
+	void release_until(const int time) {
+		while (release_time_ < time) {
+			if (held_count_ == 0) {
+				release_time_ = time;
+				break;
+			}
+			std::vector<OrderEvent> &bucket = buckets_[static_cast<unsigned int>(release_time_) & mask_];
+			ready_.insert(ready_.end(), bucket.begin(), bucket.end());
+			held_count_ -= bucket.size();
+			bucket.clear();
+			release_time_++;
+		}
+	}
+
+public:
+
+	// Horizon is the max lateness in time units (milliseconds) to reorder.
+	explicit ReorderBuffer(const int horizon) {
+		horizon_ = horizon > 0 ? horizon : 0;
+		size_t bucket_count = 1;
+		while (bucket_count < (size_t)horizon_ + 1) {
+			bucket_count *= 2;
+		}
+		mask_ = bucket_count - 1;
+		buckets_.resize(bucket_count);
+		held_count_ = 0;
+		started_ = false;
+		max_time_ = 0;
+		release_time_ = 0;
+		ready_index_ = 0;
+		late_events_ = 0;
+	}
+
+	// Adds the event that has arrived, and releases the held
+	// events which can no longer be preceded by a late event.
+	void push(const OrderEvent &event) {
+		if (!started_) {
+			started_ = true;
+			max_time_ = event.time;
+			release_time_ = event.time - horizon_;
+		}
+		if (event.time < release_time_) {
+			late_events_++;
+			ready_.push_back(event);
+			return;
+		}
+		if (event.time > max_time_) {
+			max_time_ = event.time;
+			release_until(max_time_ - horizon_);
+		}
+		buckets_[static_cast<unsigned int>(event.time) & mask_].push_back(event);
+		held_count_++;
+	}
+
+	// Releases all the held events, at the end of the input.
+	void flush() {
+		release_until(max_time_ + 1);
+	}
+
+	// Takes the next released event, returns false if there is none.
+	bool pop(OrderEvent &event) {
+		if (ready_index_ >= ready_.size()) {
+			return false;
+		}
+		event = ready_[ready_index_++];
+		if (ready_index_ == ready_.size()) {
+			ready_.clear();
+			ready_index_ = 0;
+		}
+		return true;
+	}
+
+	int horizon() const {
+		return horizon_;
+	}
+
+	// Number of events which arrived later than the horizon.
+	long long late_events() const {
+		return late_events_;
+	}
+};
+
+#endif  // TWAP_REORDER_BUFFER_H_
@@ -0,0 +1,125 @@
+// Using Google C++ coding style
+
+#include "replay.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+using namespace std;
+
+#ifdef TWAP_PROFILE
+Profiler profiler;
+#endif
+
+#ifdef TWAP_LATENCY
+LatencyHistogram latency_histogram;
+const double latency_ns_per_tick = CycleClock::measure_ns_per_tick();
+unsigned long long latency_start = 0;
+#endif
+
+#ifdef TWAP_ALLOC_CHECK
+
+long long allocation_count = 0;
+
+// not inlined, as GCC then sees malloc() and free() in place of the
+// operators, and warns about the mismatched allocation functions
+__attribute__((noinline)) void *operator new(size_t size) {
+	allocation_count++;
+	void *p = malloc(size > 0 ? size : 1);
+	if (!p) {
+		throw bad_alloc();
+	}
+	return p;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept {
+	free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+// C++14 deletes with the size, which otherwise would go to the library ones
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept {
+	free(p);
+}
+#endif
+
+#endif
+
+bool read_initial_book(const string &file_name, vector<pair<int, double> > &orders) {
+
+	FILE *input_file = fopen(file_name.c_str(), "rb");
+
+	if (!input_file) {
+		cerr << "ERROR: Can't access initial book file: " << file_name << endl;
+		return false;
+	}
+
+	string error;
+	InputStream *input = open_input_stream(input_file, error);
+	if (!input) {
+		cerr << "ERROR: Can't read initial book file " << file_name << ": " << error << endl;
+		fclose(input_file);
+		return false;
+	}
+
+	long line_number = 0;
+	{
+		LineReader line_reader(*input);
+		char *line;
+		char *line_end;
+		while (line_reader.next_line(line, line_end)) {
+			line_number++;
+			const char *pos = line;
+			while (isspace((unsigned char)*pos)) {
+				pos++;
+			}
+			if (*pos == '\0') {
+				continue; // empty line
+			}
+			int order_id;
+			double price;
+			if (!parse_int(pos, order_id) || !parse_double(pos, price)) {
+				error = "malformed order on line " + to_string(line_number);
+				break;
+			}
+			orders.push_back(make_pair(order_id, price));
+		}
+	}
+	if (error.empty()) {
+		error = input->error();
+	}
+	delete input;
+	fclose(input_file);
+	if (!error.empty()) {
+		cerr << "ERROR: Can't read initial book file " << file_name << ": " << error << endl;
+		return false;
+	}
+	return true;
+}
+
+bool load_initial_book(const string &file_name, OrderBook &order_book) {
+	vector<pair<int, double> > orders;
+	if (!read_initial_book(file_name, orders)) {
+		return false;
+	}
+	order_book.bulk_load(orders);
+	return true;
+}
+
+string base_name(const string &path) {
+	const size_t slash = path.find_last_of('/');
+	return slash == string::npos ? path : path.substr(slash + 1);
+}
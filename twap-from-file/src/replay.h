@@ -0,0 +1,396 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_REPLAY_H_
+#define TWAP_REPLAY_H_
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef TWAP_PERF_COUNTERS
+#define TWAP_PROFILE
+#endif
+
+#include "input_stream.h"
+#include "latency_histogram.h"
+#include "line_reader.h"
+#include "loser_tree.h"
+#include "order_book.h"
+#include "output_writer.h"
+#include "profiler.h"
+#include "reorder_buffer.h"
+#include "twap.h"
+#include "twap_table.h"
+
+// Replay of the order events for the modes of the program (see modes.h),
+// and its instrumentation, which is global for the program and defined
+// in replay.cpp.
+
+#ifdef TWAP_PROFILE
+extern Profiler profiler;
+#define PROFILE_MARK(stage) profiler.mark(Profiler::stage)
+#define PROFILE_COUNT_EVENT() profiler.count_event()
+#define PROFILE_COUNT_UNPARSED_LINE(line) profiler.count_unparsed_line(line)
+#define PROFILE_COUNT_SKIPPED_LINE() profiler.count_skipped_line()
+#define PROFILE_REPORT() profiler.report(std::cerr)
+#else
+#define PROFILE_MARK(stage)
+#define PROFILE_COUNT_EVENT()
+#define PROFILE_COUNT_UNPARSED_LINE(line)
+#define PROFILE_COUNT_SKIPPED_LINE()
+#define PROFILE_REPORT()
+#endif
+
+#ifdef TWAP_LATENCY
+extern LatencyHistogram latency_histogram;
+extern const double latency_ns_per_tick;
+extern unsigned long long latency_start;
+#define LATENCY_BEGIN() latency_start = CycleClock::now()
+#define LATENCY_END() latency_histogram.record( \
+	(unsigned long long)((CycleClock::now() - latency_start) * latency_ns_per_tick))
+#else
+#define LATENCY_BEGIN()
+#define LATENCY_END()
+#endif
+
+// Writes TWAP to the output, if it is already defined, and
+// publishes it with the max price into the shared memory table
+// entry, if there is one. The max price is the last one accepted
+// by TWAP, so the order book is only queried if it has changed
+// since, see update_twap().
+//
+inline void output_twap(const int time, const OrderBook &order_book, const bool max_price_changed,
+		const TWAP &twap, OutputWriter &output, TwapTable::Entry *table_entry) {
+	const double twap_price = twap.avg_price();
+	if (!std::isnan(twap_price)) {
+		output.write_line(twap_price);
+	}
+	if (table_entry) {
+		table_entry->publish(time, max_price_changed ? order_book.max_price() : twap.last_price(), twap_price);
+	}
+	PROFILE_MARK(kOutput);
+}
+
+// Passes the time of the processed events to TWAP, only querying
+// the order book for the max price if it has changed since the
+// last price accepted by TWAP.
+//
+inline void update_twap(TWAP &twap, const int time, const OrderBook &order_book, bool &max_price_changed) {
+	if (max_price_changed) {
+		const double max_price = order_book.max_price();
+		PROFILE_MARK(kMaxPrice);
+		if (twap.next_price(time, max_price)) {
+			max_price_changed = false;
+		}
+	} else {
+		twap.next_time(time);
+	}
+	PROFILE_MARK(kTwapUpdate);
+}
+
+#ifdef TWAP_ALLOC_CHECK
+
+// Counts all allocations made with the global operator new, to check
+// that the processing loop doesn't allocate memory after warm-up
+// (the capacity given to the order book and the line length permit).
+// Memory allocated directly with malloc() is not counted, the chunks
+// which the pools of the order book map are, see book_allocations().
+//
+extern long long allocation_count;
+
+// allocations, including the chunks of the order book pools
+inline long long book_allocations(const OrderBook &order_book) {
+	const OrderBookStats stats = order_book.stats();
+	return allocation_count + stats.order_index.allocations + stats.price_levels_index.allocations;
+}
+
+#define ALLOC_CHECK_EVENT(order_book) \
+	if (++alloc_check_events_ == alloc_warmup_events_) { \
+		alloc_check_start_ = book_allocations(order_book); \
+	}
+
+#else
+#define ALLOC_CHECK_EVENT(order_book)
+#endif
+
+// Command line options of the program, see main().
+//
+struct Options {
+
+	bool coalesce;
+	size_t order_capacity;
+	size_t level_capacity;
+	long alloc_warmup_events;
+	bool print_stats;
+	std::string latency_dump_file_name;
+
+	// calculate TWAP in blocks, see TwoPhaseTwapStage
+	bool two_phase;
+
+	// snapshot of the orders to start with, see load_initial_book()
+	std::string initial_book_file_name;
+
+	// time per event for the automatic compaction of the order
+	// book, or 0 to never compact, see OrderBook::auto_compact()
+	std::chrono::nanoseconds compaction_budget;
+
+	// output bars of this length instead of TWAP after each event,
+	// or 0, see BarTwapStage
+	int bar_interval;
+
+	// max lateness of the events to put back in time order,
+	// or -1 to process them as they arrive, see ReorderBuffer
+	int reorder_horizon;
+
+	// entry of the shared memory table to publish TWAP into
+	TwapTable::Entry *table_entry;
+
+	Options() {
+		coalesce = false;
+		order_capacity = 0;
+		level_capacity = 0;
+		alloc_warmup_events = 0;
+		print_stats = false;
+		two_phase = false;
+		bar_interval = 0;
+		compaction_budget = std::chrono::nanoseconds(0);
+		reorder_horizon = -1;
+		table_entry = 0;
+	}
+};
+
+// Reads the orders from the snapshot file, with a line "order_id price"
+// for each order (e.g. the start-of-day snapshot of the exchange). Prints
+// the error and returns false if the file can't be read.
+//
+bool read_initial_book(const std::string &file_name, std::vector<std::pair<int, double> > &orders);
+
+// Loads the orders from the snapshot file into the order book at once,
+// see read_initial_book() and OrderBook::bulk_load().
+//
+bool load_initial_book(const std::string &file_name, OrderBook &order_book);
+
+// Returns the file name without the directories.
+//
+std::string base_name(const std::string &path);
+
+// Reads order events from the lines of a file,
+// skipping the lines that can't be parsed.
+//
+class FileEventSource {
+
+private:
+
+	LineReader line_reader_;
+	long long event_offset_;
+
+public:
+
+	explicit FileEventSource(InputStream &input) : line_reader_(input) {
+		event_offset_ = 0;
+	}
+
+	bool next(OrderEvent &event) {
+		char *line;
+		char *line_end;
+		event_offset_ = line_reader_.offset();
+		while (line_reader_.next_line(line, line_end)) {
+			LATENCY_BEGIN();
+			if (parse_order_event(line, event)) {
+				return true;
+			}
+			PROFILE_COUNT_UNPARSED_LINE(line);
+			event_offset_ = line_reader_.offset();
+		}
+		return false;
+	}
+
+	// Offset of the line of the last event in the input.
+	long long event_offset() const {
+		return event_offset_;
+	}
+
+	// Offset in the input after the lines read so far.
+	long long offset() const {
+		return line_reader_.offset();
+	}
+};
+
+// Merges the order events from several sources, each sorted by time,
+// into one sequence sorted by time, with LoserTree. The events with the
+// same time are taken from the sources in the given order.
+//
+// Since TWAP ignores the time going back, the events from a source
+// that is not sorted are passed on as they are, and only counted.
+//
+template <typename EventSource>
+class MergedEventSource {
+
+private:
+
+	const std::vector<EventSource *> &sources_;
+	std::vector<OrderEvent> next_events_;
+	LoserTree tree_;
+	bool started_;
+	int last_time_;
+	long long out_of_order_events_;
+
+public:
+
+	explicit MergedEventSource(const std::vector<EventSource *> &sources)
+		: sources_(sources), next_events_(sources.size()), tree_(sources.size()) {
+		for (size_t i = 0; i < sources_.size(); i++) {
+			if (sources_[i]->next(next_events_[i])) {
+				tree_.set(i, next_events_[i].time);
+			}
+		}
+		tree_.build();
+		started_ = false;
+		last_time_ = 0;
+		out_of_order_events_ = 0;
+	}
+
+	bool next(OrderEvent &event) {
+		if (tree_.empty()) {
+			return false;
+		}
+		const size_t source = tree_.winner();
+		event = next_events_[source];
+		if (sources_[source]->next(next_events_[source])) {
+			tree_.next(next_events_[source].time);
+		} else {
+			tree_.finish();
+		}
+		if (started_ && event.time < last_time_) {
+			out_of_order_events_++;
+		} else {
+			last_time_ = event.time;
+		}
+		started_ = true;
+		return true;
+	}
+
+	// Number of events with the time before the time of an earlier event.
+	long long out_of_order_events() const {
+		return out_of_order_events_;
+	}
+};
+
+// Passes on the order events from the source put back in time order
+// with ReorderBuffer.
+//
+template <typename EventSource>
+class ReorderEventSource {
+
+private:
+
+	EventSource &source_;
+	ReorderBuffer buffer_;
+	bool flushed_;
+
+public:
+
+	ReorderEventSource(EventSource &source, const int horizon) : source_(source), buffer_(horizon) {
+		flushed_ = false;
+	}
+
+	bool next(OrderEvent &event) {
+		while (!buffer_.pop(event)) {
+			if (flushed_) {
+				return false;
+			}
+			OrderEvent arrived;
+			if (source_.next(arrived)) {
+				buffer_.push(arrived);
+			} else {
+				buffer_.flush();
+				flushed_ = true;
+			}
+		}
+		return true;
+	}
+
+	const ReorderBuffer &buffer() const {
+		return buffer_;
+	}
+};
+
+// Does nothing at each step of apply_events(), so that the handlers
+// only define the steps they need.
+//
+struct ReplayHandler {
+	void start(const OrderBook &) {
+	}
+	bool before(const OrderEvent &, const OrderBook &, bool &) {
+		return true;
+	}
+	void after(const OrderEvent &, OrderBook &, bool &) {
+	}
+	void finish(const OrderBook &, bool &) {
+	}
+};
+
+// Applies the events from the source to the order book, and calls the
+// handler at each step:
+//
+//   start(order_book) before the first event,
+//   before(event, order_book, max_price_changed) before each event is
+//       applied, which stops the replay if it returns false,
+//   after(event, order_book, max_price_changed) after it is applied,
+//   finish(order_book, max_price_changed) after the last event.
+//
+// max_price_changed is set when an event changes the max price (and at
+// the start, if the book has orders), and is kept until the handler
+// clears it, when the new price is accepted, see update_twap().
+//
+template <typename EventSource, typename Handler>
+void apply_events(EventSource &source, OrderBook &order_book, Handler &handler) {
+	bool max_price_changed = !std::isnan(order_book.max_price());
+	handler.start(order_book);
+	OrderEvent event;
+	while (source.next(event) && handler.before(event, order_book, max_price_changed)) {
+		if (event.operation == 'I') {
+			if (order_book.insert_order(event.order_id, event.price)) {
+				max_price_changed = true;
+			}
+		} else if (event.operation == 'E') {
+			if (order_book.erase_order(event.order_id)) {
+				max_price_changed = true;
+			}
+		}
+		handler.after(event, order_book, max_price_changed);
+	}
+	handler.finish(order_book, max_price_changed);
+}
+
+// Replays the events from the source with the handler, see apply_events(),
+// starting with the orders of the initial book, and putting the events
+// back in time order first, if selected by the options. All the modes
+// which replay the events go through it, so that these options apply to
+// all of them. Returns false if the initial book can't be loaded.
+//
+template <typename EventSource, typename Handler>
+bool replay_events(EventSource &source, const Options &options, OrderBook &order_book,
+		Handler &handler) {
+	if (!options.initial_book_file_name.empty() &&
+		!load_initial_book(options.initial_book_file_name, order_book)) {
+		return false;
+	}
+	if (options.reorder_horizon < 0) {
+		apply_events(source, order_book, handler);
+		return true;
+	}
+	ReorderEventSource<EventSource> reorder_source(source, options.reorder_horizon);
+	apply_events(reorder_source, order_book, handler);
+	const long long late_events = reorder_source.buffer().late_events();
+	if (late_events > 0) {
+		std::cerr << "WARNING: " << late_events << " events arrived later than the reorder horizon of "
+			<< reorder_source.buffer().horizon() << " and were processed out of time order" << std::endl;
+	}
+	return true;
+}
+
+#endif  // TWAP_REPLAY_H_
@@ -0,0 +1,95 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_SEQLOCK_H_
+#define TWAP_SEQLOCK_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Sequence lock protecting a small value, which is written by one
+// thread (or process, when placed in shared memory) and read by any
+// number of others, without the writer ever waiting for the readers.
+//
+// The writer makes the sequence odd while it writes, and even again
+// after. Readers copy the value and retry if the sequence was odd or
+// has changed meanwhile, so they never see a partially written value.
+// The value is stored as relaxed atomic words, so that the concurrent
+// reads are not a data race, therefore T must be trivially copyable.
+//
+// Zero-initialized memory is a valid (default) SeqLock, which
+// allows placing it into shared memory without constructing.
+//
+template <typename T>
+class SeqLock {
+
+private:
+
+	static const size_t kWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	std::atomic<uint64_t> sequence_;
+	std::atomic<uint64_t> words_[kWords];
+
+public:
+
+	SeqLock() {
+		sequence_.store(0);
+		for (size_t i = 0; i < kWords; i++) {
+			words_[i].store(0);
+		}
+	}
+
+	// Only one thread may write.
+	void store(const T &value) {
+		uint64_t words[kWords];
+		words[kWords - 1] = 0;
+		std::memcpy(words, &value, sizeof(T));
+		const uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+		sequence_.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t i = 0; i < kWords; i++) {
+			words_[i].store(words[i], std::memory_order_relaxed);
+		}
+		sequence_.store(sequence + 2, std::memory_order_release);
+	}
+
+	// Returns false if the value is being written at the moment.
+	bool try_load(T &value) const {
+		const uint64_t sequence = sequence_.load(std::memory_order_acquire);
+		if (sequence & 1) {
+			return false;
+		}
+		uint64_t words[kWords];
+		for (size_t i = 0; i < kWords; i++) {
+			words[i] = words_[i].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (sequence_.load(std::memory_order_relaxed) != sequence) {
+			return false;
+		}
+		std::memcpy(&value, words, sizeof(T));
+		return true;
+	}
+
+	// Retries until the value is read consistently.
+	T load() const {
+		T value;
+		while (!try_load(value)) {
+#if defined(__x86_64__) || defined(__i386__)
+			_mm_pause();
+#endif
+		}
+		return value;
+	}
+
+	// Number of times the value has been written.
+	uint64_t version() const {
+		return sequence_.load(std::memory_order_acquire) / 2;
+	}
+};
+
+#endif  // TWAP_SEQLOCK_H_
@@ -0,0 +1,294 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_SHM_RING_H_
+#define TWAP_SHM_RING_H_
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "order_event.h"
+
+// Single-producer single-consumer ring of order events in POSIX shared
+// memory (shm_open), through which an external feed handler process can
+// pass the events to a long-running consumer without any files or text.
+//
+// The events are stored as fixed binary records (OrderEvent), so both
+// processes must be built for the same platform. The producer only
+// writes the head index and the consumer only writes the tail index,
+// and they are kept on separate cache lines, same as the records are
+// kept away from both. Each side caches the other side's index, and
+// only reads it again when the ring looks full (or empty).
+//
+// Consumer first busy-polls for new events, and then, unless busy poll
+// is requested, sleeps on a futex (Linux only, elsewhere it yields),
+// which the producer wakes when it publishes new events or closes.
+//
+// The consumer creates the ring (and removes it when done), and the
+// producer attaches to it by the same name, so it must start after.
+//
+class ShmRing {
+
+private:
+
+	static const uint64_t kMagic = 0x474e495250415754ULL; // "TWAPRING"
+	static const int kSpinCount = 1 << 14;
+
+	struct Header {
+		uint64_t magic;
+		uint64_t capacity;
+		alignas(64) std::atomic<uint64_t> head; // next record to write
+		alignas(64) std::atomic<uint64_t> tail; // next record to read
+		alignas(64) std::atomic<uint32_t> closed;
+		std::atomic<uint32_t> consumer_waiting;
+		std::atomic<uint32_t> wake_sequence; // futex word
+	};
+
+	static const size_t kRecordsOffset = (sizeof(Header) + 63) / 64 * 64;
+
+	Header *header_;
+	OrderEvent *records_;
+	size_t mapped_size_;
+	std::string name_;
+	bool owner_;
+	bool busy_poll_;
+
+	// local copies of the indices
+	uint64_t head_;
+	uint64_t tail_;
+
+	static void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+		_mm_pause();
+#endif
+	}
+
+	static size_t mapped_size(const uint64_t capacity) {
+		return kRecordsOffset + capacity * sizeof(OrderEvent);
+	}
+
+	bool map(const int fd, const size_t size, std::string &error) {
+		void *memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (memory == MAP_FAILED) {
+			error = std::strerror(errno);
+			return false;
+		}
+		mapped_size_ = size;
+		header_ = static_cast<Header *>(memory);
+		records_ = reinterpret_cast<OrderEvent *>(static_cast<char *>(memory) + kRecordsOffset);
+		return true;
+	}
+
+	void wait(const uint32_t sequence) {
+#ifdef __linux__
+		timespec timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_nsec = 100000000; // wake up anyway, in case producer is gone
+		syscall(SYS_futex, &header_->wake_sequence, FUTEX_WAIT, sequence, &timeout, 0, 0);
+#else
+		(void)sequence;
+		sched_yield();
+#endif
+	}
+
+	void wake_consumer() {
+		if (header_->consumer_waiting.load()) {
+			header_->wake_sequence.fetch_add(1);
+#ifdef __linux__
+			syscall(SYS_futex, &header_->wake_sequence, FUTEX_WAKE, 1, 0, 0, 0);
+#endif
+		}
+	}
+
+public:
+
+	ShmRing() {
+		header_ = 0;
+		records_ = 0;
+		mapped_size_ = 0;
+		owner_ = false;
+		busy_poll_ = false;
+		head_ = 0;
+		tail_ = 0;
+	}
+
+	~ShmRing() {
+		if (header_) {
+			munmap(header_, mapped_size_);
+		}
+		if (owner_) {
+			shm_unlink(name_.c_str());
+		}
+	}
+
+	// Creates the ring for the consumer, the capacity is rounded up
+	// to a power of two. The name should start with '/'.
+	bool create(const std::string &name, const size_t capacity, std::string &error) {
+
+		uint64_t rounded_capacity = 1;
+		while (rounded_capacity < capacity) {
+			rounded_capacity *= 2;
+		}
+
+		const int fd = shm_open(name.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600);
+		if (fd < 0) {
+			error = std::strerror(errno);
+			return false;
+		}
+		name_ = name;
+		owner_ = true;
+
+		const size_t size = mapped_size(rounded_capacity);
+		const bool mapped = ftruncate(fd, size) == 0 && map(fd, size, error);
+		if (!mapped && error.empty()) {
+			error = std::strerror(errno);
+		}
+		close(fd);
+		if (!mapped) {
+			return false;
+		}
+
+		header_->capacity = rounded_capacity;
+		header_->head.store(0);
+		header_->tail.store(0);
+		header_->closed.store(0);
+		header_->consumer_waiting.store(0);
+		header_->wake_sequence.store(0);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		header_->magic = kMagic;
+		return true;
+	}
+
+	// Attaches the producer to the ring created by the consumer.
+	bool attach(const std::string &name, std::string &error) {
+
+		const int fd = shm_open(name.c_str(), O_RDWR, 0600);
+		if (fd < 0) {
+			error = std::strerror(errno);
+			return false;
+		}
+
+		struct stat st;
+		const bool mapped = fstat(fd, &st) == 0
+			&& (size_t)st.st_size >= kRecordsOffset
+			&& map(fd, st.st_size, error);
+		close(fd);
+		if (!mapped) {
+			if (error.empty()) {
+				error = "not a ring";
+			}
+			return false;
+		}
+
+		if (header_->magic != kMagic || mapped_size(header_->capacity) > mapped_size_) {
+			error = "not a ring";
+			return false;
+		}
+
+		head_ = header_->head.load();
+		tail_ = header_->tail.load();
+		return true;
+	}
+
+	// Consumer never sleeps, which costs a CPU core, but gives the lowest latency.
+	void set_busy_poll(const bool busy_poll) {
+		busy_poll_ = busy_poll;
+	}
+
+	// Producer: returns false if the ring is full.
+	bool try_push(const OrderEvent &event) {
+		const uint64_t capacity = header_->capacity;
+		if (head_ - tail_ >= capacity) {
+			tail_ = header_->tail.load(std::memory_order_acquire);
+			if (head_ - tail_ >= capacity) {
+				return false;
+			}
+		}
+		records_[head_ & (capacity - 1)] = event;
+		head_++;
+		header_->head.store(head_); // sequentially consistent, see wake_consumer()
+		wake_consumer();
+		return true;
+	}
+
+	// Producer: waits until there is space in the ring.
+	void push(const OrderEvent &event) {
+		while (!try_push(event)) {
+			sched_yield();
+		}
+	}
+
+	// Producer: no more events will be pushed.
+	void close_ring() {
+		header_->closed.store(1);
+		wake_consumer();
+	}
+
+	// Consumer: returns false if the ring is empty.
+	bool try_pop(OrderEvent &event) {
+		if (tail_ == head_) {
+			head_ = header_->head.load(std::memory_order_acquire);
+			if (tail_ == head_) {
+				return false;
+			}
+		}
+		event = records_[tail_ & (header_->capacity - 1)];
+		tail_++;
+		header_->tail.store(tail_, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer: waits for the next event, calling idle() once before
+	// waiting. Returns false when the ring is closed and empty.
+	template <typename IdleFunction>
+	bool pop(OrderEvent &event, IdleFunction idle) {
+
+		if (try_pop(event)) {
+			return true;
+		}
+
+		idle();
+
+		while (true) {
+
+			for (int i = 0; i < kSpinCount; i++) {
+				if (try_pop(event)) {
+					return true;
+				}
+				pause();
+			}
+
+			if (header_->closed.load()) {
+				return try_pop(event); // events pushed before closing
+			}
+
+			if (busy_poll_) {
+				continue;
+			}
+
+			const uint32_t sequence = header_->wake_sequence.load();
+			header_->consumer_waiting.store(1);
+			if (header_->head.load() == tail_ && !header_->closed.load()) {
+				wait(sequence);
+			}
+			header_->consumer_waiting.store(0);
+		}
+	}
+};
+
+#endif  // TWAP_SHM_RING_H_
@@ -0,0 +1,168 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_TIME_INDEX_H_
+#define TWAP_TIME_INDEX_H_
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "binary_io.h"
+#include "order_book.h"
+
+// Sparse index of an input file by time, which allows to replay only
+// a part of the file, starting from the nearest snapshot instead of
+// the beginning of the file.
+//
+// Each entry contains the time of an event, the input byte offset
+// of the line with the first event at this time, and the snapshot
+// of the order book with all events before this time. The entries
+// are written every few events, see TimeIndexWriter.
+//
+// Index file: "TWAPINDX", version, input file size, the snapshots
+// one after another, then the entries, and finally the offset of
+// the entries, so that they can be written as the snapshots are.
+//
+class TimeIndex {
+
+public:
+
+	static const unsigned int kVersion = 1;
+
+	struct Entry {
+		int time;
+		long long input_offset;
+		long long snapshot_offset;
+	};
+
+private:
+
+	std::ifstream file_;
+	long long input_size_;
+	std::vector<Entry> entries_;
+
+public:
+
+	TimeIndex() {
+		input_size_ = 0;
+	}
+
+	// Reads the entries (but not the snapshots) from the index file.
+	bool open(const std::string &file_name, std::string &error) {
+		file_.open(file_name.c_str(), std::ios::binary);
+		if (!file_) {
+			error = "can't open file";
+			return false;
+		}
+		char magic[8];
+		unsigned int version;
+		if (!file_.read(magic, 8) || std::string(magic, 8).compare("TWAPINDX") != 0 ||
+			!read_value(file_, version) || version != kVersion ||
+			!read_value(file_, input_size_)) {
+			error = "not a compatible index file";
+			return false;
+		}
+		long long entries_offset;
+		unsigned long long entry_count;
+		if (!file_.seekg(-(long long)sizeof(entries_offset), std::ios::end) ||
+			!read_value(file_, entries_offset) ||
+			!file_.seekg(entries_offset) ||
+			!read_value(file_, entry_count)) {
+			error = "index file is truncated";
+			return false;
+		}
+		entries_.resize(entry_count);
+		for (size_t i = 0; i < entries_.size(); i++) {
+			if (!read_value(file_, entries_[i].time) ||
+				!read_value(file_, entries_[i].input_offset) ||
+				!read_value(file_, entries_[i].snapshot_offset)) {
+				error = "index file is truncated";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// size of the input file when the index was built
+	long long input_size() const {
+		return input_size_;
+	}
+
+	const std::vector<Entry> &entries() const {
+		return entries_;
+	}
+
+	// Returns the last entry at or before the time, or null
+	// if the replay has to start from the beginning of the file.
+	const Entry *find(const int time) const {
+		size_t begin = 0;
+		size_t end = entries_.size();
+		while (begin < end) {
+			const size_t middle = begin + (end - begin) / 2;
+			if (entries_[middle].time <= time) {
+				begin = middle + 1;
+			} else {
+				end = middle;
+			}
+		}
+		return begin > 0 ? &entries_[begin - 1] : 0;
+	}
+
+	// Loads the snapshot of the entry into an empty order book.
+	bool read_snapshot(const Entry &entry, OrderBook &order_book) {
+		file_.clear();
+		return file_.seekg(entry.snapshot_offset) && order_book.read(file_);
+	}
+};
+
+// Writes the index file while the input is replayed, see TimeIndex.
+//
+class TimeIndexWriter {
+
+private:
+
+	std::ofstream file_;
+	std::vector<TimeIndex::Entry> entries_;
+
+public:
+
+	bool create(const std::string &file_name) {
+		file_.open(file_name.c_str(), std::ios::binary | std::ios::trunc);
+		file_.write("TWAPINDX", 8);
+		write_value<unsigned int>(file_, TimeIndex::kVersion);
+		write_value<long long>(file_, 0); // input size, written by finish()
+		return (bool)file_;
+	}
+
+	// Adds the entry for the event at the time, which starts at the
+	// input offset, with the order book before applying this event.
+	void add(const int time, const long long input_offset, const OrderBook &order_book) {
+		TimeIndex::Entry entry;
+		entry.time = time;
+		entry.input_offset = input_offset;
+		entry.snapshot_offset = file_.tellp();
+		entries_.push_back(entry);
+		order_book.write(file_);
+	}
+
+	size_t entry_count() const {
+		return entries_.size();
+	}
+
+	bool finish(const long long input_size) {
+		const long long entries_offset = file_.tellp();
+		write_value<unsigned long long>(file_, entries_.size());
+		for (size_t i = 0; i < entries_.size(); i++) {
+			write_value(file_, entries_[i].time);
+			write_value(file_, entries_[i].input_offset);
+			write_value(file_, entries_[i].snapshot_offset);
+		}
+		write_value(file_, entries_offset);
+		file_.seekp(8 + sizeof(unsigned int));
+		write_value(file_, input_size);
+		file_.close();
+		return !file_.fail();
+	}
+};
+
+#endif  // TWAP_TIME_INDEX_H_
@@ -0,0 +1,116 @@
+// Using Google C++ coding style
+
+#include "modes.h"
+
+#include <cstdio>
+#include <fstream>
+using namespace std;
+
+#include "shm_ring.h"
+
+int run_latency_report(const vector<string> &file_names, const string &dump_file_name) {
+
+	LatencyHistogram histogram;
+
+	for (size_t i = 0; i < file_names.size(); i++) {
+		ifstream in(file_names[i], ios::binary);
+		if (!histogram.read(in)) {
+			cerr << "ERROR: Can't read latency histogram from file: " << file_names[i] << endl;
+			return 1;
+		}
+	}
+
+	histogram.report(cout);
+
+	if (!dump_file_name.empty()) {
+		ofstream out(dump_file_name, ios::binary);
+		histogram.write(out);
+		if (!out.good()) {
+			cerr << "ERROR: Can't write latency histogram to file: " << dump_file_name << endl;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int run_table_reader(const string &table_name, const vector<string> &instruments) {
+
+	TwapTable table;
+	string error;
+	if (!table.open_existing(table_name, O_RDONLY, error)) {
+		cerr << "ERROR: Can't open TWAP table " << table_name << ": " << error << endl;
+		return 1;
+	}
+
+	vector<const TwapTable::Entry *> entries;
+	if (instruments.empty()) {
+		for (size_t i = 0; i < table.capacity(); i++) {
+			if (table.entry(i)) {
+				entries.push_back(table.entry(i));
+			}
+		}
+	}
+	for (size_t i = 0; i < instruments.size(); i++) {
+		const TwapTable::Entry *entry = table.find(instruments[i]);
+		if (!entry) {
+			cerr << "ERROR: No instrument in TWAP table: " << instruments[i] << endl;
+			return 1;
+		}
+		entries.push_back(entry);
+	}
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		const TwapQuote quote = entries[i]->quote.load();
+		cout << entries[i]->instrument << " " << quote.time << " "
+			 << quote.max_price << " " << quote.avg_price << endl;
+	}
+
+	return 0;
+}
+
+int run_ring_producer(const string &ring_name, const string &file_name) {
+
+	FILE *input_file = fopen(file_name.c_str(), "rb");
+
+	if (!input_file) {
+		cerr << "ERROR: Can't access input file: " << file_name << endl;
+		return 1;
+	}
+
+	ShmRing ring;
+	string error;
+	if (!ring.attach(ring_name, error)) {
+		cerr << "ERROR: Can't attach to shared memory ring " << ring_name << ": " << error << endl;
+		fclose(input_file);
+		return 1;
+	}
+
+	string input_error;
+	InputStream *input = open_input_stream(input_file, input_error);
+	if (!input) {
+		cerr << "ERROR: Can't read input file " << file_name << ": " << input_error << endl;
+		fclose(input_file);
+		return 1;
+	}
+
+	LineReader line_reader(*input);
+	char *line;
+	char *line_end;
+	while (line_reader.next_line(line, line_end)) {
+		OrderEvent event;
+		if (parse_order_event(line, event)) {
+			ring.push(event);
+		}
+	}
+
+	ring.close_ring();
+	input_error = input->error();
+	delete input;
+	fclose(input_file);
+	if (!input_error.empty()) {
+		cerr << "ERROR: Can't read input file " << file_name << ": " << input_error << endl;
+		return 1;
+	}
+	return 0;
+}
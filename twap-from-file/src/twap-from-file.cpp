@@ -10,249 +10,536 @@
 //    enough capacity to count all milliseconds in one trading day. Alternatively,
 //    the type of "time" can be changed to long for handling longer periods.
 //
-// 2) Using all names from std namespace directly without prefix, which
-//    might not always be the best idea, but it's ok for this test.
+// 2) Using all names from std namespace directly without prefix in the
+//    .cpp files of this program, which might not always be the best idea,
+//    but it's ok for this program. The headers qualify them, as they are
+//    used by other code.
 //
-// 3) Utility classes implemented below are OrderBook and TWAP.
+// 3) Main utility classes are OrderBook (order_book.h) and TWAP (twap.h),
+//    which together with TwapEngine (twap_engine.h) and its C interface
+//    (twap_c.h) form a library that can be used without this program.
 //    Please see documentation for each class.
-//    Method main() is implemented last.
-
-#include <map>
-#include <cmath>
-#include <limits>
-#include <iostream>
+//
+//    The modes of this program are in the *_modes.cpp files (see modes.h),
+//    which replay the events with the classes of replay.h. CMakeLists.txt
+//    builds the library, this program and the tests.
+//
+// 4) Compile with -DTWAP_PROFILE to get a per-stage profiling report
+//    printed to stderr at the end of the run. Without this flag, the
+//    profiling code is not compiled in at all.
+//
+//    Compile with -DTWAP_PERF_COUNTERS to also read hardware performance
+//    counters (Linux only) for each stage, which implies -DTWAP_PROFILE.
+//
+// 5) Compile with -DTWAP_LATENCY to record per-event processing latency
+//    in a histogram, see LatencyHistogram and the --latency-* options.
+//
+// 6) Compile with -DTWAP_WITH_ZLIB (link with -lz) and -DTWAP_WITH_ZSTD
+//    (link with -lzstd) to read gzip and zstd compressed input directly.
+//    The format is detected from the first bytes of the file, and it is
+//    decompressed on a helper thread, see DecompressingInputStream.
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
 #include <fstream>
-#include <sstream>
+#include <iostream>
+#include <limits>
 #include <string>
+#include <thread>
+#include <vector>
 using namespace std;
 
-// Contains current orders and automatically maintains max price.
+#include "modes.h"
+
+// ranges of the numeric options, see parse_option()
+static const long kMinInt = numeric_limits<int>::min();
+static const long kMaxInt = numeric_limits<int>::max();
+static const long kMaxLong = numeric_limits<long>::max();
+
+// max number of threads of the batch and of the parallel replay
+static const long kMaxThreads = 1024;
+
+// Parses the value of the numeric option into the result, which must be
+// a whole number from min_value to max_value. Prints the error and returns
+// false if it isn't.
+//
+template <typename T>
+bool parse_option(const string &option, const char *value, const long min_value, const long max_value,
+		T &result) {
+	char *end;
+	errno = 0;
+	const long number = strtol(value, &end, 10);
+	if (end == value || *end != '\0' || errno == ERANGE || number < min_value || number > max_value) {
+		cerr << "ERROR: Invalid " << option << " value: " << value << " (must be a whole number from "
+			 << min_value << " to " << max_value << ")." << endl;
+		return false;
+	}
+	result = number;
+	return true;
+}
+
+// Program entry point.
 //
-// Order->price map contains prices arranged by order id, so that we
-// can find the price of an order when it needs to be erased by id.
+// Usage: twap-from-file [options] file_name
+//        twap-from-file [options] --batch-out dir file_name...
+//        twap-from-file [options] --merge-inputs file_name...
+//        twap-from-file [options] --shm-ring name
+//        twap-from-file --shm-produce name file_name
+//        twap-from-file --read-twap name [instrument...]
+//        twap-from-file --build-index index_file [--index-interval n] file_name
+//        twap-from-file [--index index_file] --range begin_time end_time file_name
+//        twap-from-file --twap-queries query_file file_name
+//        twap-from-file --accumulate state_file [--session-end time] file_name
+//        twap-from-file --merge-states [--merge-out state_file] state_file...
+//        twap-from-file --latency-report [--latency-dump file] histogram_file...
 //
-// Price->count map contains the number of orders for each price point.
-// The map is sorted by price, so we can always obtain max price in O(1).
-// When there are no more orders for some price point, it is removed.
+// Options:
 //
-// Important: Using double as a key is generally not a good idea,
-// but it is justified in this case for price->count map because:
+//   --coalesce  Apply all consecutive events with the same timestamp
+//               to the order book, and only then update TWAP once and
+//               output at most one line for this timestamp. By default,
+//               TWAP is updated and output after every single event.
 //
-// 1) We are reading the prices from file and do *not* manipulate them
-//    before using as keys. Therefore, for example, if 10.3 price is read,
-//    it will be exactly equal (==) to the double 10.3 read from another line.
+//   --order-capacity n
+//   --level-capacity n
+//               Reserve memory for this many orders and price levels
+//               in the order book upfront.
 //
-// 2) We are managing an order book, and therefore in realistic conditions
-//    we actually expect to have many orders outstanding at the *same* prices.
-//    Therefore, using order counting will greatly benefit the performance,
-//    as opposed to storing *all* orders in a map by price.
+//   --initial-book file
+//               Start with the orders from the snapshot file, with a line
+//               "order_id price" for each order, loaded at once, see
+//               OrderBook::bulk_load(). Applies to all the modes which
+//               replay the file, an index must be built with the same one.
 //
-// 3) Market prices are not infinitely divisible, but instead change by
-//    ticks. Therefore, we can expect to have a *limited* number of price
-//    points around the current mid price. This counting algorithm
-//    will, again, be very effective in such conditions.
+//   --compact-budget us
+//               Return the memory of the order book after a peak of orders,
+//               by compacting it for up to us microseconds after each event,
+//               see OrderBook::auto_compact().
 //
-class OrderBook {
-
-private:
-
-	// keeps track of current orders & prices
-	map<int, double> *order_price_map_;
-
-	// counts number of orders at each price
-	map<double, int> *price_count_map_;
-
-public:
+//   --alloc-warmup n
+//               Number of events after which the processing is expected
+//               not to allocate memory any more (requires -DTWAP_ALLOC_CHECK
+//               build, which then fails with exit code 2 if it does).
+//
+//   --stats     Print live and peak order book sizes and memory usage
+//               to stderr at the end of the run (always printed when
+//               built with -DTWAP_PROFILE).
+//
+//   --latency-dump file
+//               Write the per-event latency histogram to the binary file
+//               at the end of the run (requires -DTWAP_LATENCY build).
+//
+//   --latency-report
+//               Instead of processing an input file, merge the histogram
+//               files given as arguments and report their percentiles.
+//
+//   --shm-ring name
+//               Instead of reading a file, create a shared memory ring
+//               with this name (e.g. /twap) and process the events that
+//               a producer publishes into it, until it closes the ring.
+//
+//   --shm-capacity n
+//               Number of events the ring can hold (default 65536).
+//
+//   --shm-busy-poll
+//               Never sleep while waiting for the events in the ring.
+//
+//   --shm-produce name
+//               Publish the events from the file into the existing ring,
+//               instead of the feed handler (e.g. for testing).
+//
+//   --publish name
+//               Also publish the latest TWAP, max price and time into
+//               the shared memory table with this name (e.g. /twap),
+//               creating it if needed, see TwapTable. Only applies to the
+//               modes which write TWAP after the events (a file, merged
+//               files or the ring).
+//
+//   --instrument name
+//               Name of the instrument to publish as, up to 31 characters
+//               (default is the input file or the ring name, without the
+//               directories).
+//
+//   --publish-capacity n
+//               Max number of instruments when creating the table
+//               (default 1024).
+//
+//   --read-twap name
+//               Print the latest quotes from the shared memory table
+//               for the given instruments (or all of them) and exit.
+//
+//   --batch-out dir
+//               Process each of the input files separately, writing its
+//               TWAP into dir/<file name>.twap, and print a summary line
+//               "file size_bytes output_lines seconds result" for each
+//               file to stdout, see run_batch().
+//
+//   --merge-inputs
+//               Process the events of all the input files (each sorted
+//               by time, e.g. the logs of several line handlers of the
+//               same instrument) merged by time, as one file.
+//
+//   --file-list file
+//               Also read the input file names from this file, one
+//               per line (e.g. as listed by find).
+//
+//   --threads n Number of threads for the batch (default is the number
+//               of cores).
+//
+//   --build-index index_file
+//               Write the index of the (uncompressed) input file with
+//               a snapshot of the order book every n events (default
+//               100000, see --index-interval), see TimeIndex.
+//
+//   --range begin_time end_time
+//               Print TWAP of the max price over this time range and
+//               exit. With --index, only replays the file from the last
+//               snapshot before the range, instead of from the start.
+//
+//   --twap-queries query_file
+//               Replay the file once, and print TWAP of the max price
+//               for each "begin_time end_time" line of the query file,
+//               see TwapSeries.
+//
+//   --reorder-horizon ms
+//               Hold the events until the events up to ms late have
+//               arrived, and process them in time order, see ReorderBuffer.
+//               The events arriving even later are counted and processed
+//               right away. Not supported with the index and parallel
+//               replay, which rely on the offsets of the events in the file.
+//
+//   --bars ms   Instead of TWAP after each event, output a line "begin_time
+//               twap open high low close covered_time event_count" for each
+//               bar of ms on the time grid, with TWAP and OHLC of the max
+//               price and the time with a price within the bar, see
+//               BarBuilder.
+//
+//   --two-phase Only collect the max price points while processing the
+//               events, and calculate TWAP for blocks of them at once,
+//               with SIMD where available, see TwapKernel.
+//
+//   --parallel-replay n
+//               Replay the (uncompressed) file split into chunks on n
+//               threads, each starting from the order book derived from
+//               the net effects of the earlier chunks, and calculate TWAP
+//               same as with --two-phase, see ParallelReplay. The order books
+//               of the chunks are sized by the replay, so --order-capacity,
+//               --level-capacity and --compact-budget don't apply.
+//
+//   --accumulate state_file
+//               Replay the file into the TWAP state (the price-time
+//               integral, covered time and the boundary prices), which
+//               is written to the state file, and print "twap first_time
+//               last_time covered_time", see TwapAccumulator.
+//
+//   --session-end time
+//               End the last price at this time, so that it doesn't
+//               last until the start of the next file when merged.
+//
+//   --merge-states
+//               Merge the TWAP states of consecutive parts of the series
+//               (files, days) in the given order, and print the result
+//               same as --accumulate, optionally writing it to the state
+//               file given with --merge-out.
+//
+// Note: the program doesn't output TWAP when the first order is processed
+//       because TWAP is still undefined at this time (no time has passed).
+//
+int main(int argc, char *argv[]) {
 
-	OrderBook() {
-		order_price_map_ = new map<int, double>();
-		price_count_map_ = new map<double, int>();
+	Options options;
+	bool latency_report = false;
+	string ring_name;
+	size_t ring_capacity = 1 << 16;
+	bool ring_busy_poll = false;
+	string produce_ring_name;
+	string table_name;
+	string instrument;
+	size_t table_capacity = 1024;
+	string read_table_name;
+	string batch_output_dir;
+	bool merge_inputs = false;
+	size_t thread_count = thread::hardware_concurrency();
+	string build_index_file_name;
+	long index_interval = 100000;
+	string index_file_name;
+	bool range_query = false;
+	string query_file_name;
+	size_t parallel_replay_threads = 0;
+	string accumulate_file_name;
+	bool has_session_end = false;
+	int session_end_time = 0;
+	bool merge_states = false;
+	string merge_out_file_name;
+	int range_begin_time = 0;
+	int range_end_time = 0;
+	vector<string> file_names;
+
+	for (int i = 1; i < argc; i++) {
+		const string arg = argv[i];
+		if (arg.compare("--coalesce") == 0) {
+			options.coalesce = true;
+		} else if (arg.compare("--order-capacity") == 0 && i + 1 < argc) {
+			if (!parse_option(arg, argv[++i], 0, kMaxInt, options.order_capacity)) {
+				return 1;
+			}
+		} else if (arg.compare("--level-capacity") == 0 && i + 1 < argc) {
+			if (!parse_option(arg, argv[++i], 0, kMaxInt, options.level_capacity)) {
+				return 1;
+			}
+		} else if (arg.compare("--initial-book") == 0 && i + 1 < argc) {
+			options.initial_book_file_name = argv[++i];
+		} else if (arg.compare("--compact-budget") == 0 && i + 1 < argc) {
+			long budget_us;
+			if (!parse_option(arg, argv[++i], 0, kMaxInt, budget_us)) {
+				return 1;
+			}
+			options.compaction_budget = chrono::microseconds(budget_us);
+		} else if (arg.compare("--alloc-warmup") == 0 && i + 1 < argc) {
+			if (!parse_option(arg, argv[++i], 0, kMaxLong, options.alloc_warmup_events)) {
+				return 1;
+			}
+		} else if (arg.compare("--reorder-horizon") == 0 && i + 1 < argc) {
+			if (!parse_option(arg, argv[++i], 0, kMaxInt, options.reorder_horizon)) {
+				return 1;
+			}
+		} else if (arg.compare("--bars") == 0 && i + 1 < argc) {
+			if (!parse_option(arg, argv[++i], 1, kMaxInt, options.bar_interval)) {
+				return 1;
+			}
+		} else if (arg.compare("--two-phase") == 0) {
+			options.two_phase = true;
+		} else if (arg.compare("--stats") == 0) {
+			options.print_stats = true;
+		} else if (arg.compare("--latency-report") == 0) {
+			latency_report = true;
+		} else if (arg.compare("--latency-dump") == 0 && i + 1 < argc) {
+			options.latency_dump_file_name = argv[++i];
+		} else if (arg.compare("--shm-ring") == 0 && i + 1 < argc) {
+			ring_name = argv[++i];
+		} else if (arg.compare("--shm-capacity") == 0 && i + 1 < argc) {
+			if (!parse_option(arg, argv[++i], 1, kMaxInt, ring_capacity)) {
+				return 1;
+			}
+		} else if (arg.compare("--shm-busy-poll") == 0) {
+			ring_busy_poll = true;
+		} else if (arg.compare("--shm-produce") == 0 && i + 1 < argc) {
+			produce_ring_name = argv[++i];
+		} else if (arg.compare("--publish") == 0 && i + 1 < argc) {
+			table_name = argv[++i];
+		} else if (arg.compare("--instrument") == 0 && i + 1 < argc) {
+			instrument = argv[++i];
+		} else if (arg.compare("--publish-capacity") == 0 && i + 1 < argc) {
+			if (!parse_option(arg, argv[++i], 1, kMaxInt, table_capacity)) {
+				return 1;
+			}
+		} else if (arg.compare("--read-twap") == 0 && i + 1 < argc) {
+			read_table_name = argv[++i];
+		} else if (arg.compare("--batch-out") == 0 && i + 1 < argc) {
+			batch_output_dir = argv[++i];
+		} else if (arg.compare("--merge-inputs") == 0) {
+			merge_inputs = true;
+		} else if (arg.compare("--file-list") == 0 && i + 1 < argc) {
+			ifstream file_list(argv[++i]);
+			if (!file_list) {
+				cerr << "ERROR: Can't access file list: " << argv[i] << endl;
+				return 1;
+			}
+			string file_name;
+			while (getline(file_list, file_name)) {
+				if (!file_name.empty()) {
+					file_names.push_back(file_name);
+				}
+			}
+		} else if (arg.compare("--threads") == 0 && i + 1 < argc) {
+			if (!parse_option(arg, argv[++i], 1, kMaxThreads, thread_count)) {
+				return 1;
+			}
+		} else if (arg.compare("--build-index") == 0 && i + 1 < argc) {
+			build_index_file_name = argv[++i];
+		} else if (arg.compare("--index-interval") == 0 && i + 1 < argc) {
+			if (!parse_option(arg, argv[++i], 1, kMaxLong, index_interval)) {
+				return 1;
+			}
+		} else if (arg.compare("--index") == 0 && i + 1 < argc) {
+			index_file_name = argv[++i];
+		} else if (arg.compare("--range") == 0 && i + 2 < argc) {
+			range_query = true;
+			if (!parse_option(arg, argv[++i], kMinInt, kMaxInt, range_begin_time) ||
+				!parse_option(arg, argv[++i], kMinInt, kMaxInt, range_end_time)) {
+				return 1;
+			}
+		} else if (arg.compare("--twap-queries") == 0 && i + 1 < argc) {
+			query_file_name = argv[++i];
+		} else if (arg.compare("--parallel-replay") == 0 && i + 1 < argc) {
+			if (!parse_option(arg, argv[++i], 1, kMaxThreads, parallel_replay_threads)) {
+				return 1;
+			}
+		} else if (arg.compare("--accumulate") == 0 && i + 1 < argc) {
+			accumulate_file_name = argv[++i];
+		} else if (arg.compare("--session-end") == 0 && i + 1 < argc) {
+			has_session_end = true;
+			if (!parse_option(arg, argv[++i], kMinInt, kMaxInt, session_end_time)) {
+				return 1;
+			}
+		} else if (arg.compare("--merge-states") == 0) {
+			merge_states = true;
+		} else if (arg.compare("--merge-out") == 0 && i + 1 < argc) {
+			merge_out_file_name = argv[++i];
+		} else if (arg.compare(0, 2, "--") == 0) {
+			cerr << "ERROR: Unknown option: " << arg << endl;
+			return 1;
+		} else {
+			file_names.push_back(arg);
+		}
 	}
 
-	~OrderBook() {
-		delete order_price_map_;
-		delete price_count_map_;
+	// only the modes which write TWAP after the events publish it
+	const bool publishing_mode = !latency_report && read_table_name.empty() && !merge_states &&
+		batch_output_dir.empty() && produce_ring_name.empty() && build_index_file_name.empty() &&
+		accumulate_file_name.empty() && query_file_name.empty() && parallel_replay_threads == 0 &&
+		!range_query;
+	if (!table_name.empty() && !publishing_mode) {
+		cerr << "ERROR: This mode doesn't write TWAP after the events, --publish doesn't apply." << endl;
+		return 1;
 	}
 
-	void insert_order(const int order_id, const double price) {
+	if (latency_report) {
+		return run_latency_report(file_names, options.latency_dump_file_name);
+	}
 
-		const pair<map<int, double>::iterator, bool> order_pair
-			= order_price_map_->insert(pair<int, double>(order_id, price));
+	if (!read_table_name.empty()) {
+		return run_table_reader(read_table_name, file_names);
+	}
 
-		if (order_pair.second == false) {
-			return; // order with this id already exists, not generating error, as per assumptions
-		}
+	if (merge_states) {
+		return run_merge_states(file_names, merge_out_file_name);
+	}
 
-		const pair<map<double, int>::iterator, bool> price_pair
-			= price_count_map_->insert(pair<double, int>(price, 1));
+	if (options.bar_interval > 0 && (options.coalesce || options.two_phase)) {
+		cerr << "ERROR: Bars already summarize the events, --coalesce and --two-phase don't apply." << endl;
+		return 1;
+	}
 
-		if (price_pair.second == false) {
-			price_pair.first->second++; // increment number of orders at this price
-		}
+#ifndef TWAP_LATENCY
+	if (!options.latency_dump_file_name.empty()) {
+		cerr << "ERROR: Latency recording is not compiled in, please build with -DTWAP_LATENCY." << endl;
+		return 1;
 	}
+#endif
 
-	void erase_order(const int order_id) {
+#ifdef TWAP_PERF_COUNTERS
+	profiler.enable_perf_counters();
+#endif
 
-		const map<int, double>::iterator order_it = order_price_map_->find(order_id);
+	OutputWriter output(stdout);
 
-		if (order_it == order_price_map_->end()) {
-			return; // no order with this id exists, not generating error, as per assumptions
+	TwapTable table;
+	if (!table_name.empty()) {
+		if (instrument.empty()) {
+			instrument = base_name(!ring_name.empty() ? ring_name : file_names.empty() ? "" : file_names[0]);
 		}
-
-		const double price = order_it->second;
-
-		order_price_map_->erase(order_it);
-
-		const map<double, int>::iterator price_it = price_count_map_->find(price);
-
-		price_it->second--; // decrement order count at this price
-
-		if (price_it->second <= 0) {
-			price_count_map_->erase(price_it);
+		if (instrument.empty()) {
+			cerr << "ERROR: Please specify the instrument name (see --instrument)." << endl;
+			return 1;
 		}
-	}
-
-	double max_price() const {
-		double result;
-		if (price_count_map_->empty()) {
-			result = numeric_limits<double>::quiet_NaN();
-		} else {
-			result = price_count_map_->rbegin()->first;
+		if (instrument.size() > TwapTable::kMaxInstrumentLength) {
+			cerr << "ERROR: Instrument name too long: " << instrument << " (max "
+				 << TwapTable::kMaxInstrumentLength << " characters, see --instrument)" << endl;
+			return 1;
+		}
+		string error;
+		if (!table.open(table_name, table_capacity, error)) {
+			cerr << "ERROR: Can't open TWAP table " << table_name << ": " << error << endl;
+			return 1;
+		}
+		options.table_entry = table.claim(instrument);
+		if (!options.table_entry) {
+			cerr << "ERROR: Can't publish instrument " << instrument
+				 << " (the table is full)" << endl;
+			return 1;
 		}
-		return result;
 	}
-};
-
-// Calculates time-weighted average price (TWAP).
-//
-// Each time a new price is added, we can add the previous
-// price to the average since it now lasted for the period
-// since the last price until the new price.
-//
-// The new price will only affect the time-weighted
-// average after some time has passed, when the next
-// price point is added (valid price or NAN).
-//
-// If the new price is NAN, we just save it, and later it
-// won't be taken into account for average calculation,
-// because there was "no price" during this period.
-//
-class TWAP {
-
-private:
-
-	double last_price_;
-	int last_time_;
-	double avg_price_;
-	int total_time_;
-
-public:
 
-	TWAP() {
-		last_price_ = numeric_limits<double>::quiet_NaN();
-		last_time_ = 0;
-		avg_price_ = numeric_limits<double>::quiet_NaN();
-		total_time_ = 0;
+	if (!batch_output_dir.empty()) {
+		if (!ring_name.empty() || !produce_ring_name.empty()) {
+			cerr << "ERROR: Batch mode only reads from files." << endl;
+			return 1;
+		}
+		if (file_names.empty()) {
+			cerr << "ERROR: Please specify file names as arguments." << endl;
+			return 1;
+		}
+		return run_batch(file_names, batch_output_dir, thread_count, options);
 	}
 
-	void next_price(const int time, const double price) {
-
-		if (!isnan(last_price_)) {
-
-			const int add_time = time - last_time_;
-			if (add_time < 0)  {
-				return; // time is not increasing,
-						// but not generating error
-						// as per assumptions
-			}
-			if (total_time_ > 0) {
-				// could have counted the total weighted price
-				// and then used total_weighted_price / total_time
-				// however, the task states the precision is not an issue
-				// so keeping like this for the sake of not overflowing
-				const double new_total_time = total_time_ + add_time;
-				avg_price_ = avg_price_  / new_total_time * total_time_
-						   + last_price_ / new_total_time * add_time;
-				total_time_ = new_total_time;
-			} else {
-				avg_price_ = last_price_;
-				total_time_ = add_time;
-			}
+	if (merge_inputs) {
+		if (!ring_name.empty() || !produce_ring_name.empty()) {
+			cerr << "ERROR: Merging only reads from files." << endl;
+			return 1;
 		}
-
-		last_price_ = price;
-		last_time_ = time;
+		if (file_names.empty()) {
+			cerr << "ERROR: Please specify file names as arguments." << endl;
+			return 1;
+		}
+		return run_merged_files(file_names, options, output);
 	}
 
-	double avg_price() {
-		return avg_price_;
+	if (!ring_name.empty()) {
+		return run_ring(ring_name, ring_capacity, ring_busy_poll, options, output);
 	}
-};
 
-// Program entry point.
-//
-// Note: the program doesn't output TWAP when the first order is processed
-//       because TWAP is still undefined at this time (no time has passed).
-//
-int main(int argc, char *argv[]) {
-
-	if (argc < 2) {
-		cerr << "ERROR: Please specify file name as argument.";
+	if (file_names.size() != 1) {
+		cerr << "ERROR: Please specify file name as argument (or --batch-out or --merge-inputs for many files)." << endl;
 		return 1;
 	}
 
-	const string file_name = argv[1];
-	ifstream input_stream(file_name);
+	const string file_name = file_names[0];
 
-	if (!input_stream.good()) {
-		cerr << "ERROR: Can't access input file: " << file_name;
+	if (options.reorder_horizon >= 0 && (!build_index_file_name.empty() ||
+		!index_file_name.empty() || parallel_replay_threads > 0)) {
+		cerr << "ERROR: The index and parallel replay need the events in file order,"
+			 << " --reorder-horizon doesn't apply." << endl;
 		return 1;
 	}
 
-	OrderBook order_book;
-	TWAP twap;
+	if (!produce_ring_name.empty()) {
+		return run_ring_producer(produce_ring_name, file_name);
+	}
+
+	if (!build_index_file_name.empty()) {
+		return run_build_index(file_name, build_index_file_name, index_interval, options);
+	}
 
-	for (string line; getline(input_stream, line); ) {
+	if (!accumulate_file_name.empty()) {
+		return run_accumulate(file_name, accumulate_file_name, has_session_end, session_end_time, options);
+	}
 
-		istringstream line_stream(line);
+	if (!query_file_name.empty()) {
+		return run_twap_queries(file_name, query_file_name, options);
+	}
 
-		int time;
-		if (!(line_stream >> time)) {
-			continue; // no time in this line
+	if (parallel_replay_threads > 0) {
+		if (options.coalesce || options.bar_interval > 0) {
+			cerr << "ERROR: Parallel replay doesn't support --coalesce and --bars." << endl;
+			return 1;
 		}
-
-		string operation;
-		if (!(line_stream >> operation)) {
-			continue; // no operation in this line
+		if (options.two_phase) {
+			cerr << "ERROR: Parallel replay always calculates TWAP in blocks, --two-phase doesn't apply." << endl;
+			return 1;
 		}
-
-		int order_id;
-		if (!(line_stream >> order_id)) {
-			continue; // no order_id in this line
+		if (options.order_capacity > 0 || options.level_capacity > 0 || options.compaction_budget.count() > 0) {
+			cerr << "ERROR: Parallel replay sizes the order books of its chunks itself,"
+				 << " --order-capacity, --level-capacity and --compact-budget don't apply." << endl;
+			return 1;
 		}
+		return run_parallel_replay(file_name, parallel_replay_threads, options, output);
+	}
 
-		if (operation.compare("I") == 0) {
-
-			double price;
-			if (!(line_stream >> price)) {
-				continue; // no price in this line
-			}
-
-			order_book.insert_order(order_id, price);
-
-		} else if (operation.compare("E") == 0) {
-
-			order_book.erase_order(order_id);
-
-		} // else unknown operation, assuming this doesn't happen
-
-		twap.next_price(time, order_book.max_price());
-
-		const double twap_price = twap.avg_price();
-		if (!isnan(twap_price)) {
-			cout << twap_price << endl;
-		}
+	if (range_query) {
+		return run_range_query(file_name, index_file_name, range_begin_time, range_end_time, options);
 	}
 
-	return 0;
+	return run_file(file_name, options, output);
 }
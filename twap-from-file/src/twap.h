@@ -0,0 +1,130 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_TWAP_H_
+#define TWAP_TWAP_H_
+
+#include <cmath>
+#include <limits>
+
+// Calculates time-weighted average price (TWAP).
+//
+// Each time a new price is added, we can add the previous
+// price to the average since it now lasted for the period
+// since the last price until the new price.
+//
+// The new price will only affect the time-weighted
+// average after some time has passed, when the next
+// price point is added (valid price or NAN).
+//
+// If the new price is NAN, we just save it, and later it
+// won't be taken into account for average calculation,
+// because there was "no price" during this period.
+//
+// When the price is known to be unchanged, next_time() can be
+// called instead of next_price(), which only extends the current
+// price segment. The segment is added to the average lazily, when
+// the price actually changes, and avg_price() combines the average
+// with the still open segment on the fly without modifying it.
+//
+class TWAP {
+
+private:
+
+	double last_price_;
+	int last_time_;
+	int current_time_;
+	bool extended_;
+	double avg_price_;
+	int total_time_;
+
+	// could have counted the total weighted price
+	// and then used total_weighted_price / total_time
+	// however, the task states the precision is not an issue
+	// so keeping like this for the sake of not overflowing
+	static double average(
+			const double avg_price, const int total_time,
+			const double price, const int add_time) {
+		const double new_total_time = total_time + add_time;
+		return avg_price / new_total_time * total_time
+			 + price     / new_total_time * add_time;
+	}
+
+	// adds the current segment [last_time_, current_time_]
+	// with last_price_ to the average
+	void close_segment() {
+		const int add_time = current_time_ - last_time_;
+		if (total_time_ > 0) {
+			avg_price_ = average(avg_price_, total_time_, last_price_, add_time);
+			total_time_ += add_time;
+		} else {
+			avg_price_ = last_price_;
+			total_time_ = add_time;
+		}
+	}
+
+public:
+
+	TWAP() {
+		last_price_ = std::numeric_limits<double>::quiet_NaN();
+		last_time_ = 0;
+		current_time_ = 0;
+		extended_ = false;
+		avg_price_ = std::numeric_limits<double>::quiet_NaN();
+		total_time_ = 0;
+	}
+
+	// Returns false if the price was not accepted
+	// because the time is not increasing.
+	bool next_price(const int time, const double price) {
+
+		if (!std::isnan(last_price_)) {
+
+			if (time - current_time_ < 0)  {
+				return false; // time is not increasing,
+							  // but not generating error
+							  // as per assumptions
+			}
+
+			current_time_ = time;
+			close_segment();
+		}
+
+		last_price_ = price;
+		last_time_ = time;
+		current_time_ = time;
+		extended_ = false;
+		return true;
+	}
+
+	// Same as next_price() with the last price, but cheaper.
+	void next_time(const int time) {
+
+		if (std::isnan(last_price_)) {
+			return; // nothing to add to the average
+		}
+
+		if (time - current_time_ < 0) {
+			return; // time is not increasing, see above
+		}
+
+		current_time_ = time;
+		extended_ = true;
+	}
+
+	// the price of the last next_price(), NAN if none
+	double last_price() const {
+		return last_price_;
+	}
+
+	double avg_price() const {
+		if (!extended_) {
+			return avg_price_;
+		}
+		if (total_time_ > 0) {
+			return average(avg_price_, total_time_, last_price_, current_time_ - last_time_);
+		}
+		return last_price_;
+	}
+};
+
+#endif  // TWAP_TWAP_H_
@@ -0,0 +1,177 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_TWAP_ACCUMULATOR_H_
+#define TWAP_TWAP_ACCUMULATOR_H_
+
+#include <cmath>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <string>
+
+#include "binary_io.h"
+
+// Accumulates the price-time integral and the covered time of a price
+// series (NAN prices are not covered, same as in TWAP), so that TWAP
+// is their ratio, and the accumulators of consecutive parts of the
+// series (chunks, files, days) can be merged without replaying them.
+//
+// The accumulator also keeps the first and the last price points.
+// The last price lasts until the next price point, so when merging,
+// it lasts until the first point of the next accumulator. To end it
+// at some time instead (e.g. at the close of the trading session, so
+// that the time between the sessions is not covered), call close().
+//
+// merge() is associative, and the empty accumulator is its identity,
+// so the parts can be reduced in any grouping, but in time order.
+//
+class TwapAccumulator {
+
+private:
+
+	static const unsigned int kVersion = 1;
+
+	double price_time_;
+	double covered_time_;
+	int first_time_;
+	double first_price_;
+	int last_time_;
+	double last_price_;
+	bool empty_;
+
+	void extend(const int time) {
+		if (!std::isnan(last_price_) && time > last_time_) {
+			price_time_ += last_price_ * (time - last_time_);
+			covered_time_ += time - last_time_;
+		}
+	}
+
+public:
+
+	TwapAccumulator() {
+		price_time_ = 0;
+		covered_time_ = 0;
+		first_time_ = 0;
+		first_price_ = std::numeric_limits<double>::quiet_NaN();
+		last_time_ = 0;
+		last_price_ = std::numeric_limits<double>::quiet_NaN();
+		empty_ = true;
+	}
+
+	// Adds the price point. Same as TWAP::next_price(), the point is
+	// dropped if its time goes back before the last point with a price,
+	// and then it returns false.
+	bool next_price(const int time, const double price) {
+		if (!empty_ && !std::isnan(last_price_) && time < last_time_) {
+			return false; // time is not increasing, not generating error
+		}
+		if (empty_) {
+			first_time_ = time;
+			first_price_ = price;
+			empty_ = false;
+		} else {
+			extend(time);
+		}
+		last_time_ = time;
+		last_price_ = price;
+		return true;
+	}
+
+	// Ends the last price at the time.
+	void close(const int time) {
+		next_price(time, std::numeric_limits<double>::quiet_NaN());
+	}
+
+	// Appends the accumulator of the next part of the series, which
+	// must not start before the last point of this one, unless there is
+	// no price (otherwise its points would be dropped as they are added,
+	// see next_price()).
+	void merge(const TwapAccumulator &next) {
+		if (next.empty_) {
+			return;
+		}
+		if (empty_) {
+			*this = next;
+			return;
+		}
+		extend(next.first_time_);
+		price_time_ += next.price_time_;
+		covered_time_ += next.covered_time_;
+		last_time_ = next.last_time_;
+		last_price_ = next.last_price_;
+	}
+
+	bool empty() const {
+		return empty_;
+	}
+
+	double price_time() const {
+		return price_time_;
+	}
+
+	double covered_time() const {
+		return covered_time_;
+	}
+
+	int first_time() const {
+		return first_time_;
+	}
+
+	double first_price() const {
+		return first_price_;
+	}
+
+	int last_time() const {
+		return last_time_;
+	}
+
+	double last_price() const {
+		return last_price_;
+	}
+
+	// TWAP up to the last price point, or NAN if no time was covered.
+	double avg_price() const {
+		if (covered_time_ <= 0) {
+			return std::numeric_limits<double>::quiet_NaN();
+		}
+		return price_time_ / covered_time_;
+	}
+
+	// Writes the accumulator in the native byte order.
+	void write(std::ostream &out) const {
+		out.write("TWAPACCU", 8);
+		write_value<unsigned int>(out, kVersion);
+		write_value<unsigned char>(out, empty_);
+		write_value(out, price_time_);
+		write_value(out, covered_time_);
+		write_value(out, first_time_);
+		write_value(out, first_price_);
+		write_value(out, last_time_);
+		write_value(out, last_price_);
+	}
+
+	// Reads the accumulator written by write(), returns false
+	// (and leaves this accumulator as it was) on failure.
+	bool read(std::istream &in) {
+		char magic[8];
+		unsigned int version;
+		unsigned char empty;
+		TwapAccumulator result;
+		if (!in.read(magic, 8) || std::string(magic, 8).compare("TWAPACCU") != 0 ||
+			!read_value(in, version) || version != kVersion ||
+			!read_value(in, empty) ||
+			!read_value(in, result.price_time_) ||
+			!read_value(in, result.covered_time_) ||
+			!read_value(in, result.first_time_) ||
+			!read_value(in, result.first_price_) ||
+			!read_value(in, result.last_time_) ||
+			!read_value(in, result.last_price_)) {
+			return false;
+		}
+		result.empty_ = empty != 0;
+		*this = result;
+		return true;
+	}
+};
+
+#endif  // TWAP_TWAP_ACCUMULATOR_H_
@@ -0,0 +1,136 @@
+// Using Google C++ coding style
+
+#include "twap_c.h"
+
+#include <new>
+
+#include "twap_engine.h"
+
+struct twap_engine {
+
+	TwapEngine engine;
+
+	twap_engine(const size_t order_capacity, const size_t price_level_capacity)
+		: engine(order_capacity, price_level_capacity) {
+	}
+};
+
+// No exception may leave the C functions, so each one which can throw
+// catches all of them: bad_alloc from the order book, which then leaves
+// the event not applied (see TwapEngine::insert_order()), or any other.
+
+twap_engine *twap_create(const size_t order_capacity, const size_t price_level_capacity) {
+	try {
+		return new twap_engine(order_capacity, price_level_capacity);
+	} catch (...) {
+		return 0;
+	}
+}
+
+void twap_destroy(twap_engine *engine) {
+	delete engine;
+}
+
+int twap_insert(twap_engine *engine, const int time, const int order_id, const double price) {
+	try {
+		return engine->engine.insert_order(time, order_id, price) ? 1 : 0;
+	} catch (...) {
+		return -1;
+	}
+}
+
+int twap_erase(twap_engine *engine, const int time, const int order_id) {
+	try {
+		return engine->engine.erase_order(time, order_id) ? 1 : 0;
+	} catch (...) {
+		return -1;
+	}
+}
+
+double twap_max_price(const twap_engine *engine) {
+	return engine->engine.max_price();
+}
+
+double twap_avg_price(const twap_engine *engine) {
+	return engine->engine.avg_price();
+}
+
+void twap_read_quote(const twap_engine *engine, twap_quote *quote) {
+	const TwapQuote value = engine->engine.quote();
+	quote->time = value.time;
+	quote->max_price = value.max_price;
+	quote->avg_price = value.avg_price;
+}
+
+int twap_enable_depth(twap_engine *engine, const size_t levels, const long interval_events) {
+	try {
+		engine->engine.enable_depth(levels, interval_events);
+		return 0;
+	} catch (...) {
+		return -1;
+	}
+}
+
+int twap_publish_depth(twap_engine *engine) {
+	try {
+		engine->engine.publish_depth();
+		return 0;
+	} catch (...) {
+		return -1;
+	}
+}
+
+size_t twap_read_depth(const twap_engine *engine, twap_level *levels,
+                       const size_t max_levels, int *time) {
+	const DepthPublisher *publisher = engine->engine.depth_publisher();
+	if (!publisher) {
+		return 0;
+	}
+	const DepthPublisher::ReadGuard guard(*publisher);
+	const DepthSnapshot *snapshot = guard.snapshot();
+	if (!snapshot) {
+		return 0;
+	}
+	size_t count = 0;
+	for (; count < snapshot->level_count && count < max_levels; count++) {
+		levels[count].price = snapshot->levels[count].price;
+		levels[count].count = snapshot->levels[count].count;
+	}
+	if (time) {
+		*time = snapshot->time;
+	}
+	return count;
+}
+
+void twap_set_compaction_budget(twap_engine *engine, const long long budget_ns) {
+	engine->engine.set_compaction_budget(std::chrono::nanoseconds(budget_ns));
+}
+
+int twap_compact(twap_engine *engine, const long long budget_ns) {
+	try {
+		return engine->engine.compact(std::chrono::nanoseconds(budget_ns)) ? 1 : 0;
+	} catch (...) {
+		return -1;
+	}
+}
+
+size_t twap_process(twap_engine *engine, const twap_event *events,
+                    const size_t count, double *avg_prices) {
+	size_t i = 0;
+	try {
+		for (; i < count; i++) {
+			OrderEvent event;
+			event.time = events[i].time;
+			event.operation = events[i].operation;
+			event.order_id = events[i].order_id;
+			event.price = events[i].price;
+			engine->engine.process(event);
+			if (avg_prices) {
+				avg_prices[i] = engine->engine.avg_price();
+			}
+		}
+	} catch (...) {
+		// i events were processed, and event i was not applied
+	}
+	return i;
+}
@@ -0,0 +1,120 @@
+/* Using Google C++ coding style
+ *
+ * C interface of TwapEngine (see twap_engine.h), so that TWAP can be
+ * calculated in-process by the programs written in C, or any other
+ * language that can call C functions, without linking to C++ classes.
+ *
+ * Functions never throw: the ones returning int return 1 if the max
+ * price has changed, 0 if not, or -1 if memory could not be allocated,
+ * in which case the event was not applied. The depth snapshot and the
+ * compaction after an applied event, if they can't allocate memory,
+ * don't fail the event, and are done after a later one.
+ *
+ * Engine is not thread-safe, it must only be used by one thread at a time,
+ * except for twap_read_quote() and twap_read_depth(), which can be
+ * called from any thread.
+ *
+ * To use it as a library, compile twap_c.cpp into a static or shared
+ * library, e.g. with -fPIC -fvisibility=hidden -shared, in which case
+ * only the functions declared with TWAP_API below are exported.
+ */
+
+#ifndef TWAP_TWAP_C_H_
+#define TWAP_TWAP_C_H_
+
+#include <stddef.h>
+
+#if defined(__GNUC__)
+#define TWAP_API __attribute__((visibility("default")))
+#else
+#define TWAP_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque handle of the engine. */
+typedef struct twap_engine twap_engine;
+
+/* Order event, same as one line of the input file. */
+typedef struct twap_event {
+	int time;
+	char operation; /* 'I' for insert, 'E' for erase */
+	int order_id;
+	double price;   /* only for insert */
+} twap_event;
+
+/* Returns NULL if memory could not be allocated, capacity can be 0. */
+TWAP_API twap_engine *twap_create(size_t order_capacity, size_t price_level_capacity);
+
+TWAP_API void twap_destroy(twap_engine *engine);
+
+TWAP_API int twap_insert(twap_engine *engine, int time, int order_id, double price);
+
+TWAP_API int twap_erase(twap_engine *engine, int time, int order_id);
+
+/* NAN if there are no orders. */
+TWAP_API double twap_max_price(const twap_engine *engine);
+
+/* NAN if TWAP is not defined yet. */
+TWAP_API double twap_avg_price(const twap_engine *engine);
+
+/* Values after the last event, see twap_read_quote(). */
+typedef struct twap_quote {
+	int time;
+	double max_price; /* NAN if there are no orders */
+	double avg_price; /* NAN if TWAP is not defined yet */
+} twap_quote;
+
+/* Reads the time, max price and TWAP after the last processed event
+ * consistently, from any thread, while another thread updates the
+ * engine, without blocking it (it only retries while the values are
+ * being written). */
+TWAP_API void twap_read_quote(const twap_engine *engine, twap_quote *quote);
+
+/* Price level of the order book, see twap_read_depth(). */
+typedef struct twap_level {
+	double price;
+	int count; /* number of orders at this price */
+} twap_level;
+
+/* Starts publishing snapshots of up to levels highest price levels after
+ * every interval_events events, or only on twap_publish_depth() if 0.
+ * Must be called before the readers start. Returns 0, or -1 if memory
+ * could not be allocated, in which case the previous settings are kept. */
+TWAP_API int twap_enable_depth(twap_engine *engine, size_t levels, long interval_events);
+
+/* Publishes the snapshot now, if enabled. Returns 0, or -1 if memory
+ * could not be allocated. */
+TWAP_API int twap_publish_depth(twap_engine *engine);
+
+/* Copies up to max_levels price levels (highest first) of the latest
+ * snapshot, and sets time to the time of its last event, from any thread,
+ * without blocking the thread updating the engine. Returns the number of
+ * levels, 0 if there is no snapshot yet. */
+TWAP_API size_t twap_read_depth(const twap_engine *engine, twap_level *levels,
+                                size_t max_levels, int *time);
+
+/* Compacts the order book for up to budget_ns nanoseconds after each
+ * event, when it has shrunk enough since its peak of orders, to return
+ * the memory, or never if 0 (default). */
+TWAP_API void twap_set_compaction_budget(twap_engine *engine, long long budget_ns);
+
+/* Compacts the order book for up to budget_ns nanoseconds (until done,
+ * if negative), starting the compaction if it is not in progress.
+ * Returns 1 when done, 0 if it should be called again (e.g. when idle),
+ * or -1 if memory could not be allocated. */
+TWAP_API int twap_compact(twap_engine *engine, long long budget_ns);
+
+/* Processes the events in order, and if avg_prices is not NULL, writes
+ * TWAP after each event into it. Returns the number of processed events,
+ * which is less than count only if memory could not be allocated. */
+TWAP_API size_t twap_process(twap_engine *engine, const twap_event *events,
+                             size_t count, double *avg_prices);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TWAP_TWAP_C_H_ */
@@ -0,0 +1,218 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_TWAP_ENGINE_H_
+#define TWAP_TWAP_ENGINE_H_
+
+#include <chrono>
+#include <cstddef>
+#include <new>
+
+#include "depth_publisher.h"
+#include "order_book.h"
+#include "order_event.h"
+#include "seqlock.h"
+#include "twap.h"
+#include "twap_quote.h"
+
+// Order book together with TWAP of its max price, for the programs that
+// receive order events one by one and need TWAP in-process (see twap_c.h
+// for the C interface).
+//
+// Each event is applied to the order book, and then TWAP is updated
+// at the time of the event, same as the main program does: the max
+// price is only passed to TWAP when it has changed, otherwise only
+// the current price segment is extended.
+//
+// The engine is updated by one thread, but after each event, the time,
+// max price and TWAP are also stored under a SeqLock, so that any number
+// of other threads can read them consistently with quote(), without
+// ever blocking the updating thread. Same for the snapshots of the top
+// price levels, when enabled with enable_depth(), see DepthPublisher.
+//
+// The memory of the order book after a peak of orders can be returned
+// with compact(), or automatically, see set_compaction_budget().
+//
+class TwapEngine {
+
+private:
+
+	OrderBook order_book_;
+	TWAP twap_;
+
+	// whether the max price has changed since
+	// it was last accepted by TWAP
+	bool max_price_changed_;
+	int last_time_;
+
+	DepthPublisher *depth_publisher_;
+	long depth_interval_; // events between the snapshots, 0 for on demand
+	long depth_countdown_;
+
+	// time per event for the automatic compaction, 0 if disabled
+	std::chrono::nanoseconds compaction_budget_;
+
+	// keeps the quote on its own cache lines, so that the readers
+	// don't slow down the updates of the fields above
+	char padding_[64];
+	SeqLock<TwapQuote> quote_;
+
+	void update_twap(const int time) {
+		if (max_price_changed_) {
+			if (twap_.next_price(time, order_book_.max_price())) {
+				max_price_changed_ = false;
+			}
+		} else {
+			twap_.next_time(time);
+		}
+		TwapQuote quote;
+		quote.time = time;
+		// TWAP has the max price, unless it has not accepted it yet
+		quote.max_price = max_price_changed_ ? order_book_.max_price() : twap_.last_price();
+		quote.avg_price = twap_.avg_price();
+		quote_.store(quote);
+		last_time_ = time;
+		if (depth_interval_ > 0 && --depth_countdown_ == 0) {
+			try {
+				depth_publisher_->publish(time, order_book_);
+				depth_countdown_ = depth_interval_;
+			} catch (const std::bad_alloc &) {
+				// the event is applied, the snapshot is published next time
+				depth_countdown_ = 1;
+			}
+		}
+		if (compaction_budget_.count() > 0) {
+			try {
+				order_book_.auto_compact(compaction_budget_);
+			} catch (const std::bad_alloc &) {
+				// the event is applied, the compaction continues next time
+			}
+		}
+	}
+
+	TwapEngine(const TwapEngine &);
+	TwapEngine &operator=(const TwapEngine &);
+
+public:
+
+	// Capacity is passed to the order book, see OrderBook.
+	explicit TwapEngine(const size_t order_capacity = 0, const size_t price_level_capacity = 0)
+		: order_book_(order_capacity, price_level_capacity) {
+		max_price_changed_ = false;
+		last_time_ = 0;
+		depth_publisher_ = 0;
+		depth_interval_ = 0;
+		depth_countdown_ = 0;
+		compaction_budget_ = std::chrono::nanoseconds(0);
+		TwapQuote quote;
+		quote.time = 0;
+		quote.max_price = order_book_.max_price();
+		quote.avg_price = twap_.avg_price();
+		quote_.store(quote);
+	}
+
+	~TwapEngine() {
+		delete depth_publisher_;
+	}
+
+	// Starts publishing the snapshots of up to levels highest price
+	// levels after every interval_events events (or only when asked
+	// with publish_depth(), if 0), replacing the previous settings,
+	// which are kept if it throws. Must be called before the readers
+	// start.
+	void enable_depth(const size_t levels, const long interval_events) {
+		if (!depth_publisher_ || depth_publisher_->depth() != levels) {
+			DepthPublisher *publisher = new DepthPublisher(levels);
+			delete depth_publisher_;
+			depth_publisher_ = publisher;
+		}
+		depth_interval_ = interval_events > 0 ? interval_events : 0;
+		depth_countdown_ = depth_interval_;
+	}
+
+	// Publishes the snapshot of the order book now, if enabled.
+	void publish_depth() {
+		if (depth_publisher_) {
+			depth_publisher_->publish(last_time_, order_book_);
+		}
+	}
+
+	// Null until enabled, the readers can use it from any thread
+	// with DepthPublisher::ReadGuard.
+	const DepthPublisher *depth_publisher() const {
+		return depth_publisher_;
+	}
+
+	// Compacts the order book for up to the time budget after each event,
+	// when it has shrunk enough since its peak (see OrderBook::auto_compact()),
+	// or never, if the budget is 0.
+	void set_compaction_budget(const std::chrono::nanoseconds budget) {
+		compaction_budget_ = budget;
+	}
+
+	// Starts compacting the order book, if it is not in progress, and
+	// continues for the time budget (until done, if negative). Returns
+	// true when done, otherwise it should be called again later (e.g.
+	// when idle), see OrderBook::compact().
+	bool compact(const std::chrono::nanoseconds budget) {
+		if (!order_book_.compacting()) {
+			order_book_.start_compaction();
+		}
+		return order_book_.compact(budget);
+	}
+
+	// Returns true if the max price has changed as a result. Only the
+	// order book can throw (if memory can't be allocated), and then the
+	// event is not applied, while the depth snapshots and the compaction
+	// after the event are skipped until the next event if they can't.
+	bool insert_order(const int time, const int order_id, const double price) {
+		const bool changed = order_book_.insert_order(order_id, price);
+		if (changed) {
+			max_price_changed_ = true;
+		}
+		update_twap(time);
+		return changed;
+	}
+
+	// Returns true if the max price has changed as a result, doesn't throw.
+	bool erase_order(const int time, const int order_id) {
+		const bool changed = order_book_.erase_order(order_id);
+		if (changed) {
+			max_price_changed_ = true;
+		}
+		update_twap(time);
+		return changed;
+	}
+
+	// Same as insert_order() or erase_order(), depending on the
+	// event operation, unknown operations only advance the time.
+	bool process(const OrderEvent &event) {
+		if (event.operation == 'I') {
+			return insert_order(event.time, event.order_id, event.price);
+		}
+		if (event.operation == 'E') {
+			return erase_order(event.time, event.order_id);
+		}
+		update_twap(event.time);
+		return false;
+	}
+
+	double max_price() const {
+		return order_book_.max_price();
+	}
+
+	double avg_price() const {
+		return twap_.avg_price();
+	}
+
+	const OrderBook &order_book() const {
+		return order_book_;
+	}
+
+	// Returns the time, max price and TWAP after the last event, and
+	// unlike the other methods, can be called from any thread.
+	TwapQuote quote() const {
+		return quote_.load();
+	}
+};
+
+#endif  // TWAP_TWAP_ENGINE_H_
@@ -0,0 +1,178 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_TWAP_KERNEL_H_
+#define TWAP_TWAP_KERNEL_H_
+
+#include <cmath>
+#include <cstddef>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "twap.h"
+
+// Calculates running TWAP for a block of price points at once, which
+// is the second phase of the two-phase pipeline: the first phase only
+// updates the order book and collects the (time, max price) points.
+//
+// TWAP after each point is the price-time integral divided by the time
+// with a price (NAN prices are not counted, same as in TWAP):
+//
+//   avg[i] = sum(price[j - 1] * duration[j], j <= i) / sum(duration[j], j <= i)
+//
+// Unlike TWAP::next_price(), where each division depends on the result
+// of the previous one, here only the two prefix sums are sequential,
+// and the durations, masks, products and divisions are independent, so
+// they are calculated two at a time with SSE2 (and by the compiler's
+// vectorizer on other platforms).
+//
+// The points are expected in time order (as per assumptions). Same as
+// TWAP::next_price(), a point whose time goes back before the last
+// accepted point is dropped, and the last accepted price carries on,
+// so the blocks with such points are calculated one point at a time.
+// Until some time has passed with a price, the average is taken from
+// TWAP, which defines it for this case, so the output is the same as
+// from TWAP (within rounding, since the average is calculated
+// differently).
+//
+class TwapKernel {
+
+private:
+
+	double price_time_;   // integral of the price over time
+	double covered_time_; // time with a price
+	int last_time_;
+	double last_price_;
+	bool started_;
+
+	// only used until some time has passed with a price
+	TWAP start_twap_;
+
+	double avg_price() const {
+		return covered_time_ > 0 ? price_time_ / covered_time_ : start_twap_.avg_price();
+	}
+
+	// adds the segment since the last point up to the point
+	double add_point(const int time, const double price) {
+		if (started_ && !std::isnan(last_price_) && time < last_time_) {
+			return avg_price(); // time is not increasing, dropped as by TWAP
+		}
+		if (started_ && !std::isnan(last_price_) && time > last_time_) {
+			price_time_ += last_price_ * (time - last_time_);
+			covered_time_ += time - last_time_;
+		}
+		if (covered_time_ <= 0) {
+			if (!started_ || price != last_price_) {
+				start_twap_.next_price(time, price);
+			} else {
+				start_twap_.next_time(time);
+			}
+		}
+		started_ = true;
+		last_time_ = time;
+		last_price_ = price;
+		return avg_price();
+	}
+
+public:
+
+	TwapKernel() {
+		price_time_ = 0;
+		covered_time_ = 0;
+		last_time_ = 0;
+		last_price_ = 0;
+		started_ = false;
+	}
+
+	// Continues after the points with these sums, and the last point.
+	TwapKernel(const double price_time, const double covered_time,
+			const int last_time, const double last_price) {
+		price_time_ = price_time;
+		covered_time_ = covered_time;
+		last_time_ = last_time;
+		last_price_ = last_price;
+		started_ = true;
+	}
+
+	// Adds the points, and writes TWAP after each of them into avg_prices
+	// (NAN where it is not yet defined). The blocks can be of any size.
+	void run(const int *times, const double *prices, const size_t count, double *avg_prices) {
+
+		bool time_goes_back = started_ && count > 0 && times[0] < last_time_;
+		for (size_t i = 1; i < count; i++) {
+			time_goes_back |= times[i] < times[i - 1];
+		}
+		if (time_goes_back) {
+			for (size_t i = 0; i < count; i++) {
+				avg_prices[i] = add_point(times[i], prices[i]);
+			}
+			return;
+		}
+
+		size_t i = 0;
+
+		// at least the first point, to have the previous point in the block
+		while (i < count && (i == 0 || covered_time_ <= 0)) {
+			avg_prices[i] = add_point(times[i], prices[i]);
+			i++;
+		}
+
+		double price_time = price_time_;
+		double covered_time = covered_time_;
+
+#ifdef __SSE2__
+		// the sums are carried in the low lane, and added in the same
+		// order as by the scalar loop, to get exactly the same result
+		const __m128d zero = _mm_setzero_pd();
+		__m128d price_time_carry = _mm_set_sd(price_time);
+		__m128d covered_time_carry = _mm_set_sd(covered_time);
+
+		for (; i + 2 <= count; i += 2) {
+
+			// segments [i - 1, i] and [i, i + 1]
+			const __m128i time_pairs = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(times + i));
+			const __m128i last_time_pairs = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(times + i - 1));
+			const __m128d durations = _mm_max_pd(zero, _mm_sub_pd(
+				_mm_cvtepi32_pd(time_pairs), _mm_cvtepi32_pd(last_time_pairs)));
+			const __m128d last_prices = _mm_loadu_pd(prices + i - 1);
+			const __m128d has_price = _mm_cmpord_pd(last_prices, last_prices);
+
+			__m128d covered = _mm_and_pd(has_price, durations);
+			__m128d weighted = _mm_and_pd(has_price, _mm_mul_pd(last_prices, durations));
+
+			// prefix sums of the carry and the two lanes
+			covered = _mm_add_pd(covered, covered_time_carry);
+			weighted = _mm_add_pd(weighted, price_time_carry);
+			covered = _mm_add_pd(covered, _mm_castsi128_pd(_mm_slli_si128(_mm_castpd_si128(covered), 8)));
+			weighted = _mm_add_pd(weighted, _mm_castsi128_pd(_mm_slli_si128(_mm_castpd_si128(weighted), 8)));
+			covered_time_carry = _mm_unpackhi_pd(covered, zero);
+			price_time_carry = _mm_unpackhi_pd(weighted, zero);
+
+			_mm_storeu_pd(avg_prices + i, _mm_div_pd(weighted, covered));
+		}
+
+		price_time = _mm_cvtsd_f64(price_time_carry);
+		covered_time = _mm_cvtsd_f64(covered_time_carry);
+#endif
+
+		for (; i < count; i++) {
+			const double last_price = prices[i - 1];
+			const int duration = times[i] - times[i - 1];
+			if (!std::isnan(last_price) && duration > 0) {
+				price_time += last_price * duration;
+				covered_time += duration;
+			}
+			avg_prices[i] = price_time / covered_time;
+		}
+
+		price_time_ = price_time;
+		covered_time_ = covered_time;
+		if (count > 0) {
+			last_time_ = times[count - 1];
+			last_price_ = prices[count - 1];
+		}
+	}
+};
+
+#endif  // TWAP_TWAP_KERNEL_H_
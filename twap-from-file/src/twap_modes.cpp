@@ -0,0 +1,559 @@
+// Using Google C++ coding style
+
+#include "modes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
+using namespace std;
+
+#include "bar_builder.h"
+#include "parallel_replay.h"
+#include "shm_ring.h"
+#include "twap_kernel.h"
+#include "work_stealing_pool.h"
+
+// Reads order events from a shared memory ring, until the producer
+// closes it. The output is flushed before waiting for new events,
+// so that the readers get TWAP without delay.
+//
+class RingEventSource {
+
+private:
+
+	ShmRing &ring_;
+	OutputWriter &output_;
+
+	struct FlushOutput {
+		OutputWriter &output;
+		void operator()() const {
+			output.flush();
+		}
+	};
+
+public:
+
+	RingEventSource(ShmRing &ring, OutputWriter &output) : ring_(ring), output_(output) {
+	}
+
+	bool next(OrderEvent &event) {
+		const FlushOutput flush_output = { output_ };
+		if (!ring_.pop(event, flush_output)) {
+			return false;
+		}
+		LATENCY_BEGIN();
+		return true;
+	}
+};
+
+// Updates TWAP and writes it to the output after each time point,
+// see update_twap() and output_twap().
+//
+class SerialTwapStage {
+
+private:
+
+	TWAP twap_;
+
+public:
+
+	explicit SerialTwapStage(const Options &) {
+	}
+
+	void next(const int time, const OrderBook &order_book, bool &max_price_changed,
+			OutputWriter &output, TwapTable::Entry *table_entry) {
+		update_twap(twap_, time, order_book, max_price_changed);
+		output_twap(time, order_book, max_price_changed, twap_, output, table_entry);
+	}
+
+	void finish(OutputWriter &, TwapTable::Entry *) {
+	}
+};
+
+// Only collects the (time, max price) points, and calculates TWAP
+// for a whole block of them at once with TwapKernel, which is then
+// written to the output. Only the last TWAP of each block is published
+// to the shared memory table.
+//
+class TwoPhaseTwapStage {
+
+private:
+
+	static const size_t kBlockSize = 4096;
+
+	TwapKernel kernel_;
+	vector<int> times_;
+	vector<double> prices_;
+	vector<double> avg_prices_;
+	size_t size_;
+	double max_price_;
+
+public:
+
+	explicit TwoPhaseTwapStage(const Options &)
+		: times_(kBlockSize), prices_(kBlockSize), avg_prices_(kBlockSize) {
+		size_ = 0;
+		max_price_ = numeric_limits<double>::quiet_NaN();
+	}
+
+	void next(const int time, const OrderBook &order_book, bool &max_price_changed,
+			OutputWriter &output, TwapTable::Entry *table_entry) {
+		if (max_price_changed) {
+			max_price_ = order_book.max_price();
+			max_price_changed = false;
+			PROFILE_MARK(kMaxPrice);
+		}
+		times_[size_] = time;
+		prices_[size_] = max_price_;
+		if (++size_ == kBlockSize) {
+			finish(output, table_entry);
+		}
+	}
+
+	void finish(OutputWriter &output, TwapTable::Entry *table_entry) {
+		if (size_ == 0) {
+			return;
+		}
+		kernel_.run(&times_[0], &prices_[0], size_, &avg_prices_[0]);
+		PROFILE_MARK(kTwapUpdate);
+		for (size_t i = 0; i < size_; i++) {
+			if (!isnan(avg_prices_[i])) {
+				output.write_line(avg_prices_[i]);
+			}
+		}
+		if (table_entry) {
+			table_entry->publish(times_[size_ - 1], prices_[size_ - 1], avg_prices_[size_ - 1]);
+		}
+		size_ = 0;
+		PROFILE_MARK(kOutput);
+	}
+};
+
+// Summarizes the max price over the bars of the time grid with
+// BarBuilder, and writes a line "begin_time twap open high low close
+// covered_time event_count" for each bar to the output. Each bar is
+// also published to the shared memory table, at the end of the bar.
+//
+class BarTwapStage {
+
+private:
+
+	BarBuilder bars_;
+	double max_price_;
+
+	struct WriteBar {
+		OutputWriter &output;
+		TwapTable::Entry *table_entry;
+		int interval;
+		void operator()(const Bar &bar) const {
+			char line[256];
+			const int size = snprintf(line, sizeof(line), "%d %g %g %g %g %g %lld %lld\n",
+				bar.begin_time, bar.twap, bar.open, bar.high, bar.low, bar.close,
+				(long long)bar.covered_time, bar.event_count);
+			output.write(line, size);
+			if (table_entry) {
+				table_entry->publish(bar.begin_time + interval, bar.close, bar.twap);
+			}
+		}
+	};
+
+public:
+
+	explicit BarTwapStage(const Options &options) : bars_(options.bar_interval) {
+		max_price_ = numeric_limits<double>::quiet_NaN();
+	}
+
+	void next(const int time, const OrderBook &order_book, bool &max_price_changed,
+			OutputWriter &output, TwapTable::Entry *table_entry) {
+		if (max_price_changed) {
+			max_price_ = order_book.max_price();
+			max_price_changed = false;
+			PROFILE_MARK(kMaxPrice);
+		}
+		WriteBar write_bar = { output, table_entry, bars_.interval() };
+		bars_.next(time, max_price_, write_bar);
+		PROFILE_MARK(kTwapUpdate);
+	}
+
+	void finish(OutputWriter &output, TwapTable::Entry *table_entry) {
+		WriteBar write_bar = { output, table_entry, bars_.interval() };
+		bars_.finish(write_bar);
+		PROFILE_MARK(kOutput);
+	}
+};
+
+// Updates TWAP with the TwapStage during the replay, and writes it to the
+// output, after each event or (when coalescing) each time, see
+// process_events().
+//
+template <typename TwapStage>
+class TwapReplay : public ReplayHandler {
+
+private:
+
+	const Options &options_;
+	OutputWriter &output_;
+	TwapStage twap_stage_;
+
+	// when coalescing, the time of the events
+	// applied to the order book, but not yet to TWAP
+	bool has_pending_time_;
+	int pending_time_;
+
+#ifdef TWAP_ALLOC_CHECK
+	long alloc_warmup_events_;
+	long alloc_check_events_;
+	long long alloc_check_start_;
+#endif
+
+public:
+
+	TwapReplay(const Options &options, OutputWriter &output)
+		: options_(options), output_(output), twap_stage_(options) {
+		has_pending_time_ = false;
+		pending_time_ = 0;
+	}
+
+	void start(const OrderBook &order_book) {
+#ifdef TWAP_ALLOC_CHECK
+		alloc_warmup_events_ = options_.alloc_warmup_events;
+		alloc_check_events_ = 0;
+		alloc_check_start_ = book_allocations(order_book);
+#else
+		(void)order_book;
+#endif
+	}
+
+	bool before(const OrderEvent &event, const OrderBook &order_book, bool &max_price_changed) {
+		PROFILE_MARK(kParse);
+		if (has_pending_time_ && event.time != pending_time_) {
+			// all events for the pending time are now in the book
+			twap_stage_.next(pending_time_, order_book, max_price_changed, output_, options_.table_entry);
+			has_pending_time_ = false;
+		}
+		return true;
+	}
+
+	void after(const OrderEvent &event, OrderBook &order_book, bool &max_price_changed) {
+		if (event.operation == 'I' || event.operation == 'E') {
+			PROFILE_COUNT_EVENT();
+		} else {
+			// unknown operation, assuming this doesn't happen
+			PROFILE_COUNT_SKIPPED_LINE();
+		}
+
+		PROFILE_MARK(kBookUpdate);
+
+		if (options_.coalesce) {
+			has_pending_time_ = true;
+			pending_time_ = event.time;
+		} else {
+			twap_stage_.next(event.time, order_book, max_price_changed, output_, options_.table_entry);
+		}
+
+		if (options_.compaction_budget.count() > 0) {
+			order_book.auto_compact(options_.compaction_budget);
+		}
+
+		LATENCY_END();
+		ALLOC_CHECK_EVENT(order_book);
+	}
+
+	void finish(const OrderBook &order_book, bool &max_price_changed) {
+		if (has_pending_time_) {
+			twap_stage_.next(pending_time_, order_book, max_price_changed, output_, options_.table_entry);
+			has_pending_time_ = false;
+		}
+		twap_stage_.finish(output_, options_.table_entry);
+		output_.flush();
+	}
+
+#ifdef TWAP_ALLOC_CHECK
+	// Allocations after the warm-up events.
+	long long steady_allocations(const OrderBook &order_book) const {
+		return book_allocations(order_book) - alloc_check_start_;
+	}
+#endif
+};
+
+// Processes all events from the source, writes TWAP to the output,
+// and the reports to stderr. Returns the exit code of the program.
+//
+// TwapStage is SerialTwapStage, TwoPhaseTwapStage or BarTwapStage.
+//
+template <typename TwapStage, typename EventSource>
+int process_events(EventSource &source, const Options &options, OutputWriter &output) {
+
+	OrderBook order_book(options.order_capacity, options.level_capacity);
+	TwapReplay<TwapStage> twap_replay(options, output);
+
+	if (!replay_events(source, options, order_book, twap_replay)) {
+		return 1;
+	}
+
+	int result = 0;
+
+#ifdef TWAP_ALLOC_CHECK
+	const long long steady_allocations = twap_replay.steady_allocations(order_book);
+	cerr << "ALLOC: " << steady_allocations << " allocations after "
+		 << options.alloc_warmup_events << " warm-up events" << endl;
+	if (steady_allocations > 0) {
+		result = 2;
+	}
+#endif
+
+	PROFILE_REPORT();
+
+	bool print_stats = options.print_stats;
+#ifdef TWAP_PROFILE
+	print_stats = true;
+#endif
+
+	if (print_stats) {
+		order_book.stats().report(cerr);
+	}
+
+#ifdef TWAP_LATENCY
+	latency_histogram.report(cerr);
+	if (!options.latency_dump_file_name.empty()) {
+		ofstream latency_dump(options.latency_dump_file_name, ios::binary);
+		latency_histogram.write(latency_dump);
+		if (!latency_dump.good()) {
+			cerr << "ERROR: Can't write latency histogram to file: " << options.latency_dump_file_name << endl;
+			return 1;
+		}
+	}
+#endif
+
+	return result;
+}
+
+// Processes the events with the TWAP stage selected by the options.
+//
+template <typename EventSource>
+int process_events(EventSource &source, const Options &options, OutputWriter &output) {
+	if (options.bar_interval > 0) {
+		return process_events<BarTwapStage>(source, options, output);
+	}
+	if (options.two_phase) {
+		return process_events<TwoPhaseTwapStage>(source, options, output);
+	}
+	return process_events<SerialTwapStage>(source, options, output);
+}
+
+int run_file(const string &file_name, const Options &options, OutputWriter &output) {
+
+	FILE *input_file = fopen(file_name.c_str(), "rb");
+
+	if (!input_file) {
+		cerr << "ERROR: Can't access input file: " << file_name << endl;
+		return 1;
+	}
+
+	string input_error;
+	InputStream *input = open_input_stream(input_file, input_error);
+	if (!input) {
+		cerr << "ERROR: Can't read input file " << file_name << ": " << input_error << endl;
+		fclose(input_file);
+		return 1;
+	}
+
+	FileEventSource source(*input);
+	int result = process_events(source, options, output);
+	input_error = input->error();
+	delete input;
+	fclose(input_file);
+	if (!input_error.empty()) {
+		cerr << "ERROR: Can't read input file " << file_name << ": " << input_error << endl;
+		result = 1;
+	}
+	return result;
+}
+
+int run_merged_files(const vector<string> &file_names, const Options &options, OutputWriter &output) {
+
+	vector<FILE *> input_files;
+	vector<InputStream *> inputs;
+	vector<FileEventSource *> sources;
+	int result = 0;
+
+	for (size_t i = 0; i < file_names.size() && result == 0; i++) {
+		FILE *input_file = fopen(file_names[i].c_str(), "rb");
+		if (!input_file) {
+			cerr << "ERROR: Can't access input file: " << file_names[i] << endl;
+			result = 1;
+			break;
+		}
+		input_files.push_back(input_file);
+		string input_error;
+		InputStream *input = open_input_stream(input_file, input_error);
+		if (!input) {
+			cerr << "ERROR: Can't read input file " << file_names[i] << ": " << input_error << endl;
+			result = 1;
+			break;
+		}
+		inputs.push_back(input);
+		sources.push_back(new FileEventSource(*input));
+	}
+
+	if (result == 0) {
+		MergedEventSource<FileEventSource> source(sources);
+		result = process_events(source, options, output);
+		if (source.out_of_order_events() > 0) {
+			cerr << "WARNING: " << source.out_of_order_events()
+				 << " events were out of time order (input files must be sorted by time)" << endl;
+		}
+	}
+
+	for (size_t i = 0; i < inputs.size(); i++) {
+		const string input_error = inputs[i]->error();
+		if (!input_error.empty()) {
+			cerr << "ERROR: Can't read input file " << file_names[i] << ": " << input_error << endl;
+			result = 1;
+		}
+		delete sources[i];
+		delete inputs[i];
+	}
+	for (size_t i = 0; i < input_files.size(); i++) {
+		fclose(input_files[i]);
+	}
+	return result;
+}
+
+// One input file of the batch, see run_batch().
+//
+struct BatchFile {
+	string file_name;
+	string output_file_name;
+	long long size;
+	int result;
+	long long lines;
+	double seconds;
+};
+
+int run_batch(const vector<string> &file_names, const string &output_dir,
+		size_t thread_count, const Options &options) {
+
+#if defined(TWAP_PROFILE) || defined(TWAP_LATENCY) || defined(TWAP_ALLOC_CHECK)
+	// instrumentation is global for the program, so can't be shared
+	thread_count = 1;
+#endif
+
+	vector<BatchFile> files(file_names.size());
+	vector<size_t> order(files.size());
+	for (size_t i = 0; i < files.size(); i++) {
+		BatchFile &file = files[i];
+		file.file_name = file_names[i];
+		file.output_file_name = output_dir + "/" + base_name(file.file_name) + ".twap";
+		ifstream input(file.file_name.c_str(), ios::binary | ios::ate);
+		file.size = input ? (long long)input.tellg() : 0;
+		file.result = 1;
+		file.lines = 0;
+		file.seconds = 0;
+		order[i] = i;
+	}
+
+	map<string, size_t> output_files;
+	for (size_t i = 0; i < files.size(); i++) {
+		const pair<map<string, size_t>::iterator, bool> output_pair
+			= output_files.insert(make_pair(files[i].output_file_name, i));
+		if (!output_pair.second) {
+			cerr << "ERROR: Input files " << files[output_pair.first->second].file_name
+				 << " and " << files[i].file_name << " would both be written to "
+				 << files[i].output_file_name << endl;
+			return 1;
+		}
+	}
+
+	struct LargerFirst {
+		const vector<BatchFile> &files;
+		bool operator()(const size_t a, const size_t b) const {
+			return files[a].size > files[b].size;
+		}
+	};
+	LargerFirst larger_first = { files };
+	stable_sort(order.begin(), order.end(), larger_first);
+
+	struct ProcessFile {
+		vector<BatchFile> &files;
+		const Options &options;
+		void operator()(const size_t index) const {
+			BatchFile &file = files[index];
+			const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			FILE *output_file = fopen(file.output_file_name.c_str(), "wb");
+			if (!output_file) {
+				cerr << "ERROR: Can't create output file: " << file.output_file_name << endl;
+				return;
+			}
+			{
+				OutputWriter output(output_file);
+				file.result = run_file(file.file_name, options, output);
+				file.lines = output.lines();
+			}
+			if (fclose(output_file) != 0) {
+				cerr << "ERROR: Can't write output file: " << file.output_file_name << endl;
+				file.result = 1;
+			}
+			file.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		}
+	};
+	ProcessFile process_file = { files, options };
+
+	const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	WorkStealingPool pool(thread_count);
+	pool.run(order, process_file);
+	const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	int result = 0;
+	long long total_size = 0;
+	for (size_t i = 0; i < files.size(); i++) {
+		const BatchFile &file = files[i];
+		cout << file.file_name << " " << file.size << " " << file.lines << " "
+			 << file.seconds << " " << file.result << endl;
+		total_size += file.size;
+		if (file.result != 0) {
+			result = 1;
+		}
+	}
+	cout << "TOTAL: " << files.size() << " files, " << total_size << " bytes, "
+		 << seconds << " seconds on " << pool.thread_count() << " threads" << endl;
+
+	return result;
+}
+
+int run_ring(const string &ring_name, const size_t ring_capacity, const bool busy_poll,
+		const Options &options, OutputWriter &output) {
+
+	ShmRing ring;
+	string error;
+	if (!ring.create(ring_name, ring_capacity, error)) {
+		cerr << "ERROR: Can't create shared memory ring " << ring_name << ": " << error << endl;
+		return 1;
+	}
+	ring.set_busy_poll(busy_poll);
+	RingEventSource source(ring, output);
+	return process_events(source, options, output);
+}
+
+int run_parallel_replay(const string &file_name, const size_t thread_count,
+		const Options &options, OutputWriter &output) {
+
+	ParallelReplay replay(file_name);
+	if (!options.initial_book_file_name.empty()) {
+		vector<pair<int, double> > orders;
+		if (!read_initial_book(options.initial_book_file_name, orders)) {
+			return 1;
+		}
+		replay.set_initial_book(orders);
+	}
+	string error;
+	if (!replay.run(thread_count, thread_count, output, error)) {
+		cerr << "ERROR: Can't replay input file " << file_name << ": " << error << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,15 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_TWAP_QUOTE_H_
+#define TWAP_TWAP_QUOTE_H_
+
+// Latest values after an event: its time, the max price of the
+// order book, and TWAP, see TwapEngine::quote() and TwapTable.
+//
+struct TwapQuote {
+	int time;
+	double max_price;
+	double avg_price;
+};
+
+#endif  // TWAP_TWAP_QUOTE_H_
@@ -0,0 +1,103 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_TWAP_SERIES_H_
+#define TWAP_TWAP_SERIES_H_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Step function of the price over time, with the prefix sums of the
+// price-time integral and of the covered time at each step, so that
+// TWAP over any time interval can be found with a binary search:
+//
+//   TWAP(t0, t1) = (integral(t1) - integral(t0)) / (covered(t1) - covered(t0))
+//
+// Same as in TWAP, the time when the price is NAN is not covered,
+// and doesn't count towards the average.
+//
+// The price of the last step lasts indefinitely, same as in a replay
+// that continues after the last event, see run_range_query().
+//
+class TwapSeries {
+
+private:
+
+	std::vector<int> times_;
+	std::vector<double> prices_;   // price from the time until the next step
+	std::vector<double> integral_; // price-time integral up to the time
+	std::vector<double> covered_;  // time with a price up to the time
+
+	// index of the last step at or before the time, which must not
+	// be before the first step
+	size_t step_at(const int time) const {
+		return std::upper_bound(times_.begin(), times_.end(), time) - times_.begin() - 1;
+	}
+
+	void integrate(const int time, double &integral, double &covered) const {
+		if (times_.empty() || time <= times_[0]) {
+			integral = 0;
+			covered = 0;
+			return;
+		}
+		const size_t i = step_at(time);
+		const double price = prices_[i];
+		const int add_time = time - times_[i];
+		integral = integral_[i];
+		covered = covered_[i];
+		if (!std::isnan(price)) {
+			integral += price * add_time;
+			covered += add_time;
+		}
+	}
+
+public:
+
+	// Adds the step with the new price at the time, or replaces the price
+	// of the last step at this time. Returns false if the time goes back,
+	// and the step is not added (same as TWAP::next_price()).
+	bool add(const int time, const double price) {
+		if (!times_.empty()) {
+			const size_t last = times_.size() - 1;
+			if (time < times_[last]) {
+				return false; // time is not increasing, ignoring as per assumptions
+			}
+			if (time == times_[last]) {
+				prices_[last] = price;
+				return true;
+			}
+			const double last_price = prices_[last];
+			const int add_time = time - times_[last];
+			const bool has_price = !std::isnan(last_price);
+			integral_.push_back(integral_[last] + (has_price ? last_price * add_time : 0));
+			covered_.push_back(covered_[last] + (has_price ? add_time : 0));
+		} else {
+			integral_.push_back(0);
+			covered_.push_back(0);
+		}
+		times_.push_back(time);
+		prices_.push_back(price);
+		return true;
+	}
+
+	size_t size() const {
+		return times_.size();
+	}
+
+	// Returns TWAP over the interval, or NAN if there
+	// was no price at any time during the interval.
+	double twap(const int begin_time, const int end_time) const {
+		double begin_integral, begin_covered;
+		double end_integral, end_covered;
+		integrate(begin_time, begin_integral, begin_covered);
+		integrate(end_time, end_integral, end_covered);
+		const double covered = end_covered - begin_covered;
+		if (covered <= 0) {
+			return std::numeric_limits<double>::quiet_NaN();
+		}
+		return (end_integral - begin_integral) / covered;
+	}
+};
+
+#endif  // TWAP_TWAP_SERIES_H_
@@ -0,0 +1,226 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_TWAP_TABLE_H_
+#define TWAP_TWAP_TABLE_H_
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "seqlock.h"
+#include "twap_quote.h"
+
+// Table of the latest TWAP quotes per instrument in POSIX shared memory
+// (shm_open), so that any number of local processes can sample current
+// TWAP without reading the output of the program.
+//
+// Each instrument has its own entry (on its own cache lines) with the
+// quote protected by a SeqLock, so the writer of the instrument never
+// waits, and the readers never block it. Writers (one per instrument,
+// e.g. one process per instrument) claim their entries by name, and
+// the entries are never released, so the readers can keep pointers.
+//
+// The table is created by whoever opens it first, and stays in shared
+// memory after all processes exit (remove it with shm_unlink, or from
+// /dev/shm on Linux), so the readers can still see the last values.
+//
+class TwapTable {
+
+public:
+
+	static const size_t kMaxInstrumentLength = 31;
+
+	struct Entry {
+
+		// 0 if free, 1 if being claimed, 2 if instrument is set
+		std::atomic<uint32_t> state;
+		char instrument[kMaxInstrumentLength + 1];
+		SeqLock<TwapQuote> quote;
+
+		void publish(const int time, const double max_price, const double avg_price) {
+			TwapQuote value;
+			value.time = time;
+			value.max_price = max_price;
+			value.avg_price = avg_price;
+			quote.store(value);
+		}
+	};
+
+private:
+
+	static const uint64_t kMagic = 0x4c42415450415754ULL; // "TWAPTABL"
+
+	struct Header {
+		std::atomic<uint64_t> magic;
+		uint64_t capacity;
+	};
+
+	struct alignas(64) PaddedEntry {
+		Entry entry;
+	};
+
+	static const size_t kEntriesOffset = (sizeof(Header) + 63) / 64 * 64;
+
+	Header *header_;
+	PaddedEntry *entries_;
+	size_t mapped_size_;
+
+	bool map(const int fd, const size_t size, std::string &error) {
+		void *memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (memory == MAP_FAILED) {
+			error = std::strerror(errno);
+			return false;
+		}
+		mapped_size_ = size;
+		header_ = static_cast<Header *>(memory);
+		entries_ = reinterpret_cast<PaddedEntry *>(static_cast<char *>(memory) + kEntriesOffset);
+		return true;
+	}
+
+public:
+
+	TwapTable() {
+		header_ = 0;
+		entries_ = 0;
+		mapped_size_ = 0;
+	}
+
+	~TwapTable() {
+		if (header_) {
+			munmap(header_, mapped_size_);
+		}
+	}
+
+	// Opens the table, creating it with the given capacity (number of
+	// instruments) if it doesn't exist yet. The name should start with '/'.
+	bool open(const std::string &name, const size_t capacity, std::string &error) {
+
+		const size_t size = kEntriesOffset + capacity * sizeof(PaddedEntry);
+
+		int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+		if (fd >= 0) {
+			// created, new memory is zeroed, which is a valid empty table
+			const bool mapped = ftruncate(fd, size) == 0 && map(fd, size, error);
+			if (!mapped && error.empty()) {
+				error = std::strerror(errno);
+			}
+			close(fd);
+			if (!mapped) {
+				return false;
+			}
+			header_->capacity = capacity;
+			header_->magic.store(kMagic);
+			return true;
+		}
+
+		if (errno != EEXIST) {
+			error = std::strerror(errno);
+			return false;
+		}
+		return open_existing(name, O_RDWR, error);
+	}
+
+	// Opens the table created by a writer, readers may open it read-only.
+	bool open_existing(const std::string &name, const int flags, std::string &error) {
+
+		const int fd = shm_open(name.c_str(), flags, 0);
+		if (fd < 0) {
+			error = std::strerror(errno);
+			return false;
+		}
+
+		// wait for the creator to set the size
+		struct stat st;
+		for (int i = 0; i < 1000 && fstat(fd, &st) == 0 && (size_t)st.st_size < kEntriesOffset; i++) {
+			sched_yield();
+		}
+
+		const int protection = flags == O_RDONLY ? PROT_READ : PROT_READ | PROT_WRITE;
+		void *memory = (size_t)st.st_size < kEntriesOffset ? MAP_FAILED
+			: mmap(0, st.st_size, protection, MAP_SHARED, fd, 0);
+		close(fd);
+		if (memory == MAP_FAILED) {
+			error = "not a TWAP table";
+			return false;
+		}
+		mapped_size_ = st.st_size;
+		header_ = static_cast<Header *>(memory);
+		entries_ = reinterpret_cast<PaddedEntry *>(static_cast<char *>(memory) + kEntriesOffset);
+
+		// wait for the creator to initialize the header
+		for (int i = 0; i < 1000 && header_->magic.load() != kMagic; i++) {
+			sched_yield();
+		}
+		if (header_->magic.load() != kMagic
+			|| kEntriesOffset + header_->capacity * sizeof(PaddedEntry) > mapped_size_) {
+			error = "not a TWAP table";
+			return false;
+		}
+		return true;
+	}
+
+	size_t capacity() const {
+		return header_->capacity;
+	}
+
+	// Returns the entry with the instrument set, or 0 if this entry is free.
+	const Entry *entry(const size_t index) const {
+		const Entry *result = &entries_[index].entry;
+		return result->state.load(std::memory_order_acquire) == 2 ? result : 0;
+	}
+
+	const Entry *find(const std::string &instrument) const {
+		for (size_t i = 0; i < capacity(); i++) {
+			const Entry *result = entry(i);
+			if (result && instrument.compare(result->instrument) == 0) {
+				return result;
+			}
+		}
+		return 0;
+	}
+
+	// Returns the entry of the instrument for the writer, claiming a free
+	// one if needed, or 0 if the table is full or the name is too long.
+	Entry *claim(const std::string &instrument) {
+
+		if (instrument.empty() || instrument.size() > kMaxInstrumentLength) {
+			return 0;
+		}
+
+		for (size_t i = 0; i < capacity(); i++) {
+
+			Entry *result = &entries_[i].entry;
+
+			uint32_t state = result->state.load(std::memory_order_acquire);
+			if (state == 0) {
+				uint32_t expected = 0;
+				if (result->state.compare_exchange_strong(expected, 1)) {
+					std::memcpy(result->instrument, instrument.c_str(), instrument.size() + 1);
+					result->state.store(2, std::memory_order_release);
+					return result;
+				}
+				state = expected;
+			}
+
+			while (state == 1) { // another writer is claiming it
+				sched_yield();
+				state = result->state.load(std::memory_order_acquire);
+			}
+
+			if (instrument.compare(result->instrument) == 0) {
+				return result;
+			}
+		}
+
+		return 0;
+	}
+};
+
+#endif  // TWAP_TWAP_TABLE_H_
@@ -0,0 +1,99 @@
+// Using Google C++ coding style
+
+#ifndef TWAP_WORK_STEALING_POOL_H_
+#define TWAP_WORK_STEALING_POOL_H_
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs a batch of independent tasks on a fixed number of threads.
+//
+// The tasks are dealt to per-thread queues in the given order, so
+// when they are sorted by decreasing cost, each thread starts with
+// the largest tasks. A thread takes its next task from the front
+// of its own queue, and when that is empty, steals from the back
+// of another queue, where the smallest remaining tasks are, which
+// evens out the finishing times of the threads.
+//
+// Tasks are identified by index, and the queues are only locked
+// once per task, which is fine for tasks as large as a whole file.
+//
+class WorkStealingPool {
+
+private:
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<size_t> tasks;
+	};
+
+	std::vector<Queue> queues_;
+
+	bool pop_own(const size_t thread, size_t &task) {
+		Queue &queue = queues_[thread];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) {
+			return false;
+		}
+		task = queue.tasks.front();
+		queue.tasks.pop_front();
+		return true;
+	}
+
+	bool steal(const size_t thread, size_t &task) {
+		for (size_t i = 1; i < queues_.size(); i++) {
+			Queue &queue = queues_[(thread + i) % queues_.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.tasks.empty()) {
+				task = queue.tasks.back();
+				queue.tasks.pop_back();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	template <typename Function>
+	void work(const size_t thread, Function &function) {
+		size_t task;
+		while (pop_own(thread, task) || steal(thread, task)) {
+			function(task);
+		}
+	}
+
+public:
+
+	explicit WorkStealingPool(const size_t thread_count)
+		: queues_(thread_count > 0 ? thread_count : 1) {
+	}
+
+	size_t thread_count() const {
+		return queues_.size();
+	}
+
+	// Calls function(task) for each task in the order, and returns
+	// when all of them are done. The function must be thread-safe.
+	template <typename Function>
+	void run(const std::vector<size_t> &order, Function function) {
+
+		for (size_t i = 0; i < order.size(); i++) {
+			queues_[i % queues_.size()].tasks.push_back(order[i]);
+		}
+
+		// the calling thread works as the first thread of the pool
+		std::vector<std::thread> threads;
+		for (size_t thread = 1; thread < queues_.size(); thread++) {
+			threads.push_back(std::thread(&WorkStealingPool::work<Function>,
+				this, thread, std::ref(function)));
+		}
+		work(0, function);
+		for (size_t i = 0; i < threads.size(); i++) {
+			threads[i].join();
+		}
+	}
+};
+
+#endif  // TWAP_WORK_STEALING_POOL_H_
@@ -0,0 +1,29 @@
+#!/bin/bash
+# Using Google C++ coding style
+#
+# Checks that the processing loop doesn't allocate memory after warm-up:
+# replays a synthetic input with twap-from-file built with
+# -DTWAP_ALLOC_CHECK (the twap-from-file-alloc-check target of
+# CMakeLists.txt), with the order book capacity reserved for its peak
+# of orders.
+#
+#   test/alloc_check.sh twap_binary work_dir [events]
+#
+# Exits with 1 if any allocation is counted after the warm-up events.
+
+TWAP=$(realpath "$1") || exit 1
+WORK_DIR=$(mkdir -p "$2" && realpath "$2") || exit 1
+cd "$(dirname "$0")/.." || exit 1
+EVENTS=${3:-1000000}
+MAX_LIVE=10000
+INPUT="$WORK_DIR/alloc_check_input.txt"
+
+test/gen_events.sh "$EVENTS" "$MAX_LIVE" > "$INPUT" || exit 1
+
+# the levels are on a 2000 cent grid, and the warm-up covers the first
+# growth of the line buffer and the output
+"$TWAP" --order-capacity $MAX_LIVE --level-capacity 2000 \
+	--alloc-warmup 1000 "$INPUT" > /dev/null
+STATUS=$?
+rm -f "$INPUT"
+exit $STATUS
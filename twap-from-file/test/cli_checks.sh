@@ -0,0 +1,158 @@
+#!/bin/bash
+# Using Google C++ coding style
+#
+# Regression checks of the twap-from-file program, run by ctest (see
+# CMakeLists.txt), with the files they write in the work directory:
+#
+#   test/cli_checks.sh twap_binary work_dir
+#
+# Each check prints its name and PASS or FAIL, and the script exits
+# with 1 if any of them has failed.
+
+TWAP=$(realpath "$1") || exit 1
+WORK_DIR=$(mkdir -p "$2" && realpath "$2") || exit 1
+cd "$(dirname "$0")/.." || exit 1
+
+FAILED=0
+
+check() {
+	local name=$1
+	shift
+	if "$@"; then
+		echo "PASS $name"
+	else
+		echo "FAIL $name"
+		FAILED=1
+	fi
+}
+
+# output of the input file must be the same as the expected one
+same_output() {
+	"$TWAP" "$1" | cmp -s - "$2"
+}
+
+check "test1" same_output test1.txt test/test1.expected
+check "test2" same_output test2.txt test/test2.expected
+
+# the lines with "nan", "inf", hex or overflowing prices are skipped
+check "non-finite prices" same_output test3.txt test/test3.expected
+
+# TWAP adds a segment of the same max price once the price changes,
+# rather than after each of its events, which rounds differently from
+# the first version (102.85 rather than 102.849 on line 33)
+check "rounding of the price segments" same_output test4.txt test/test4.expected
+
+# two inputs with the same name would overwrite each other's output
+batch_rejects_same_names() {
+	local dir="$WORK_DIR/batch"
+	mkdir -p "$dir/d1" "$dir/d2" "$dir/out" || return 1
+	cp test1.txt "$dir/d1/x.txt" && cp test2.txt "$dir/d2/x.txt" || return 1
+	! "$TWAP" --batch-out "$dir/out" "$dir/d1/x.txt" "$dir/d2/x.txt" > /dev/null 2>&1
+}
+check "batch with the same file names" batch_rejects_same_names
+
+# the options which parallel replay would ignore are rejected, and so
+# is --publish in the modes which don't publish, without creating the
+# table
+rejects_options() {
+	! "$TWAP" "$@" test1.txt > /dev/null 2>&1
+}
+for option in "--publish /twap-cli-checks" "--two-phase" "--order-capacity 100" "--level-capacity 100" \
+	"--compact-budget 10"; do
+	check "parallel replay rejects $option" rejects_options --parallel-replay 2 $option
+done
+no_table_without_publishing() {
+	rm -f /dev/shm/twap-cli-checks
+	rejects_options --publish /twap-cli-checks --range 1000 2000 &&
+		rejects_options --publish /twap-cli-checks --build-index "$WORK_DIR/test1.index" &&
+		[ ! -e /dev/shm/twap-cli-checks ]
+}
+check "publish only in the publishing modes" no_table_without_publishing
+
+# the numeric options must be whole numbers in their ranges
+for option in "--bars -5" "--bars 0" "--parallel-replay 0" "--compact-budget abc" "--order-capacity 1e3" \
+	"--reorder-horizon -1" "--threads 99999999999999999999" "--range 1000 x"; do
+	check "rejects $option" rejects_options $option
+done
+
+# the same TWAP (within rounding) as the serial replay, on an input
+# whose time goes back, given with the output of the serial replay
+same_as_serial() {
+	local input=$1
+	local expected=$2
+	shift 2
+	"$TWAP" "$@" "$input" | paste -d ' ' "$expected" - | awk '
+		{ d = $1 - $2; if (d < 0) d = -d; m = $1 < 0 ? -$1 : $1 }
+		NF != 2 || d > 1e-9 + 1e-5 * m { bad++ }
+		END { exit bad > 0 }'
+}
+
+test/gen_events.sh 100000 1000 2 > "$WORK_DIR/ordered.txt" || exit 1
+# all events shuffled, and the times moved by up to 50 ms
+shuf --random-source=<(yes) "$WORK_DIR/ordered.txt" > "$WORK_DIR/shuffled.txt" || exit 1
+awk 'BEGIN { srand(3) } { $1 += int(rand() * 101) - 50; print }' \
+	"$WORK_DIR/ordered.txt" > "$WORK_DIR/jittered.txt" || exit 1
+for input in shuffled jittered; do
+	"$TWAP" "$WORK_DIR/$input.txt" > "$WORK_DIR/$input.serial" || exit 1
+	check "$input: two-phase" same_as_serial "$WORK_DIR/$input.txt" "$WORK_DIR/$input.serial" --two-phase
+	for threads in 1 3 16; do
+		check "$input: parallel replay, $threads threads" same_as_serial \
+			"$WORK_DIR/$input.txt" "$WORK_DIR/$input.serial" --parallel-replay $threads
+	done
+done
+
+# the initial book applies to all the modes: orders below most of the
+# prices of the input, which set the max price before the first event
+# and after the last one
+awk 'BEGIN { srand(4); for (i = 0; i < 300; i++) printf "%d %.2f\n", 50000000 + i, 90 + int(rand() * 1000) / 100 }' \
+	> "$WORK_DIR/initial_book.txt" || exit 1
+"$TWAP" --initial-book "$WORK_DIR/initial_book.txt" "$WORK_DIR/ordered.txt" \
+	> "$WORK_DIR/initial_book.serial" || exit 1
+check "initial book: two-phase" same_as_serial "$WORK_DIR/ordered.txt" "$WORK_DIR/initial_book.serial" \
+	--initial-book "$WORK_DIR/initial_book.txt" --two-phase
+for threads in 1 3; do
+	check "initial book: parallel replay, $threads threads" same_as_serial "$WORK_DIR/ordered.txt" \
+		"$WORK_DIR/initial_book.serial" --initial-book "$WORK_DIR/initial_book.txt" --parallel-replay $threads
+done
+
+# the same TWAP over the ranges from the query file with --twap-queries,
+# and with --range with and without the index, given the options
+same_ranges() {
+	local input=$1
+	local queries=$2
+	shift 2
+	"$TWAP" "$@" --build-index "$WORK_DIR/ranges.index" --index-interval 5000 "$input" 2> /dev/null || return 1
+	local twap=($("$TWAP" "$@" --twap-queries "$queries" "$input")) || return 1
+	local i=0
+	local begin_time
+	local end_time
+	while read begin_time end_time; do
+		[ "$("$TWAP" "$@" --range $begin_time $end_time "$input")" = "${twap[$i]}" ] || return 1
+		[ "$("$TWAP" "$@" --index "$WORK_DIR/ranges.index" --range $begin_time $end_time "$input")" \
+			= "${twap[$i]}" ] || return 1
+		i=$((i + 1))
+	done < "$queries"
+}
+printf "1100 1500\n100000 140000\n1100 200000\n" > "$WORK_DIR/ranges.txt"
+check "initial book: range queries" same_ranges "$WORK_DIR/ordered.txt" "$WORK_DIR/ranges.txt" \
+	--initial-book "$WORK_DIR/initial_book.txt"
+initial_book_applies() {
+	[ "$("$TWAP" --initial-book "$WORK_DIR/initial_book.txt" --range 1100 200000 "$WORK_DIR/ordered.txt")" \
+		!= "$("$TWAP" --range 1100 200000 "$WORK_DIR/ordered.txt")" ]
+}
+check "initial book: applied to the range query" initial_book_applies
+
+# and so does the reorder horizon: the same results as with the input
+# sorted by time (keeping the order of the events with the same time)
+sort -s -n -k1,1 "$WORK_DIR/jittered.txt" > "$WORK_DIR/sorted.txt" || exit 1
+same_as_sorted() {
+	cmp -s <("$TWAP" --reorder-horizon 200 "$@" "$WORK_DIR/jittered.txt") \
+		<("$TWAP" "$@" "$WORK_DIR/sorted.txt")
+}
+check "reorder horizon" same_as_sorted
+check "reorder horizon: two-phase" same_as_sorted --two-phase
+check "reorder horizon: range query" same_as_sorted --range 1100 200000
+check "reorder horizon: TWAP queries" same_as_sorted --twap-queries "$WORK_DIR/ranges.txt"
+check "reorder horizon: accumulate" same_as_sorted --accumulate "$WORK_DIR/accumulate.state"
+
+exit $FAILED
@@ -0,0 +1,217 @@
+// Using Google C++ coding style
+
+// Latency test of OrderBook::auto_compact(): inserts orders over many
+// price levels, then erases all but a few of them (and inserts a new one
+// now and then), with auto_compact() after each event, and measures the
+// thread CPU time of each call which compacts, so that the scheduling of
+// the machine is not counted. Each step of the compaction is bounded,
+// so a call must take the budget and one more step. Interrupts of the
+// system (or of the host of a virtual machine) are counted in the thread
+// time too, so after each call a probe spins for the budget, and the
+// percentiles of the calls must be within a few budgets of the ones of
+// the probes. The compaction must also return the memory of the peak,
+// and keep the book the same as the reference. Then a small book is
+// compacted, which must not grow its pools.
+//
+//   compaction_latency [orders [budget_us]]
+//
+// Prints the worst and percentile times, and exits with 1 if they are
+// over the limits, or on a mismatch.
+
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "order_book.h"
+using namespace std;
+
+// the prices are kMinPrice + ticks / 100, for up to kPriceTicks ticks
+static const int kMinPrice = 50;
+static const int kPriceTicks = 100000;
+
+// the events between the checks of the whole depth, during compaction
+static const int kDepthCheckInterval = 997;
+
+// budgets a call may take longer than a probe, at the 99th percentile
+static const double kCallBudgets = 2;
+
+// the same at the 99.9th percentile, where the steps are the system
+// calls which the system takes longer for (e.g. to free the pages)
+static const double kSlowCallBudgets = 4;
+
+static double thread_time_us() {
+	timespec time;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+	return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+static double tick_price(const int tick) {
+	return kMinPrice + tick / 100.0;
+}
+
+// The orders expected at each price tick, which doesn't allocate memory
+// after the start, so that the allocator has the same state as with the
+// order book alone (e.g. no small blocks freed for the next allocation
+// of a chunk to merge).
+struct Reference {
+	vector<int> counts;
+	int levels;
+	int max_tick; // -1 if none
+
+	Reference() : counts(kPriceTicks), levels(0), max_tick(-1) {
+	}
+
+	void insert(const int tick) {
+		levels += counts[tick]++ == 0;
+		max_tick = max(max_tick, tick);
+	}
+
+	void erase(const int tick) {
+		levels -= --counts[tick] == 0;
+		while (max_tick >= 0 && counts[max_tick] == 0) {
+			max_tick--;
+		}
+	}
+};
+
+// compares the max price, or the whole depth
+static bool same_book(const OrderBook &book, const Reference &reference, vector<PriceLevel> &depth,
+	const bool depth_check) {
+	if (!depth_check) {
+		return reference.max_tick < 0 ? isnan(book.max_price())
+			: book.max_price() == tick_price(reference.max_tick);
+	}
+	if (book.copy_depth(&depth[0], depth.size()) != (size_t)reference.levels) {
+		return false;
+	}
+	size_t i = 0;
+	for (int tick = reference.max_tick; tick >= 0; tick--) {
+		if (reference.counts[tick] > 0) {
+			if (depth[i].price != tick_price(tick) || depth[i].count != reference.counts[tick]) {
+				return false;
+			}
+			i++;
+		}
+	}
+	return true;
+}
+
+static bool shrinks_peak(const int orders, const chrono::nanoseconds budget) {
+	OrderBook book;
+	Reference reference;
+	const int kept = orders / 400;
+	vector<int> ticks;
+	ticks.reserve(orders + orders / 1000 + 1);
+	srand(1);
+	for (int i = 0; i < orders; i++) {
+		ticks.push_back(rand() % kPriceTicks);
+		book.insert_order(i, tick_price(ticks.back()));
+		reference.insert(ticks.back());
+	}
+	const OrderBookStats peak = book.stats();
+
+	vector<double> times;
+	vector<double> probes;
+	times.reserve(orders);
+	probes.reserve(orders);
+	const double budget_us = budget.count() / 1e3;
+	vector<PriceLevel> depth(kPriceTicks + 1);
+	for (int i = kept; i < orders || book.compacting(); i++) {
+		if (i < orders) {
+			book.erase_order(i);
+			reference.erase(ticks[i]);
+			if (i % 1000 == 0) {
+				ticks.push_back(rand() % kPriceTicks);
+				book.insert_order(ticks.size() - 1, tick_price(ticks.back()));
+				reference.insert(ticks.back());
+			}
+		}
+		const bool compacting = book.compacting();
+		const double start = thread_time_us();
+		book.auto_compact(budget);
+		const double time = thread_time_us() - start;
+		if (compacting || book.compacting()) {
+			times.push_back(time);
+			const double probe_start = thread_time_us();
+			double probe_end = probe_start;
+			while (probe_end - probe_start < budget_us) {
+				probe_end = thread_time_us();
+			}
+			probes.push_back(probe_end - probe_start);
+		}
+		if (!same_book(book, reference, depth, book.compacting() && i % kDepthCheckInterval == 0)) {
+			cerr << "ERROR: the order book differs after event " << i << endl;
+			return false;
+		}
+	}
+	if (!same_book(book, reference, depth, true)) {
+		cerr << "ERROR: the order book differs at the end" << endl;
+		return false;
+	}
+
+	if (times.empty()) {
+		cerr << "ERROR: the compaction has not started" << endl;
+		return false;
+	}
+	sort(times.begin(), times.end());
+	sort(probes.begin(), probes.end());
+	const double p99 = times[times.size() * 99 / 100];
+	const double p999 = times[times.size() * 999 / 1000];
+	const double probe_p99 = probes[probes.size() * 99 / 100];
+	const double probe_p999 = probes[probes.size() * 999 / 1000];
+	cout << times.size() << " calls with the budget of " << budget_us << " us: p99 " << p99 << " us, p99.9 "
+		 << p999 << " us, worst " << times.back() << " us" << endl;
+	cout << "probes: p99 " << probe_p99 << " us, p99.9 " << probe_p999 << " us, worst " << probes.back()
+		 << " us" << endl;
+	const OrderBookStats stats = book.stats();
+	cout << "reserved " << peak.order_index.reserved_bytes << " -> " << stats.order_index.reserved_bytes
+		 << " bytes for the orders, " << peak.price_levels_index.reserved_bytes << " -> "
+		 << stats.price_levels_index.reserved_bytes << " bytes for the price levels" << endl;
+
+	if (p99 > probe_p99 + kCallBudgets * budget_us || p999 > probe_p999 + kSlowCallBudgets * budget_us) {
+		cerr << "ERROR: the compaction is over the budget" << endl;
+		return false;
+	}
+	if (stats.order_index.reserved_bytes * 10 > peak.order_index.reserved_bytes ||
+		stats.price_levels_index.reserved_bytes * 3 > peak.price_levels_index.reserved_bytes * 2) {
+		cerr << "ERROR: the compaction has not returned the memory" << endl;
+		return false;
+	}
+	return true;
+}
+
+// a small book, whose pool of the price levels has no room to spare,
+// only compacts the orders
+static bool keeps_small_book() {
+	OrderBook book;
+	for (int i = 0; i < 1000; i++) {
+		book.insert_order(i, 90 + i % 300 / 100.0);
+	}
+	for (int i = 300; i < 1000; i++) {
+		book.erase_order(i);
+	}
+	const OrderBookStats before = book.stats();
+	book.start_compaction();
+	book.compact();
+	const OrderBookStats after = book.stats();
+	cout << "reserved " << before.order_index.reserved_bytes << " -> " << after.order_index.reserved_bytes
+		 << " bytes for the orders, " << before.price_levels_index.reserved_bytes << " -> "
+		 << after.price_levels_index.reserved_bytes << " bytes for the price levels of a small book" << endl;
+	if (after.order_index.reserved_bytes >= before.order_index.reserved_bytes ||
+		after.price_levels_index.reserved_bytes > before.price_levels_index.reserved_bytes) {
+		cerr << "ERROR: the compaction has not shrunk the orders, or has grown the price levels" << endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	const int orders = argc > 1 ? atoi(argv[1]) : 4000000;
+	const chrono::nanoseconds budget(argc > 2 ? atoi(argv[2]) * 1000 : 10000);
+	return shrinks_peak(orders, budget) && keeps_small_book() ? 0 : 1;
+}
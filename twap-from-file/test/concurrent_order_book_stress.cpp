@@ -0,0 +1,162 @@
+// Using Google C++ coding style
+
+// Stress test of ConcurrentOrderBook: generates random order events,
+// which keep up to a few thousand orders on a cent grid in the book,
+// and replays them from several producer threads, each of which gets
+// the orders with id modulo the number of threads equal to its number
+// (the same as one thread per feed line). The events are replayed in
+// phases, and after each one the book must have the same orders, max
+// price and depth as OrderBook after a sequential replay of the same
+// events. The events leave orders in the book at the end.
+//
+//   concurrent_order_book_stress [events [phases]]
+//
+// Prints the time for each number of threads, and exits with 1 on the
+// first mismatch.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "concurrent_order_book.h"
+#include "order_book.h"
+using namespace std;
+
+// the prices are kMinTick / kTicksPerUnit to kMaxTick / kTicksPerUnit
+static const int kTicksPerUnit = 100;
+static const int kMinTick = 9000;
+static const int kMaxTick = 11000;
+
+// orders in the book, at most, so that the max price often changes
+static const size_t kMaxLiveOrders = 3000;
+
+struct StressEvent {
+	bool insert;
+	int order_id;
+	double price;
+};
+
+static vector<StressEvent> generate_events(const int count) {
+	vector<StressEvent> events;
+	vector<int> live;
+	int next_id = 1;
+	srand(1);
+	for (int i = 0; i < count; i++) {
+		StressEvent event;
+		event.insert = live.empty() || (live.size() < kMaxLiveOrders && rand() % 100 < 55);
+		if (event.insert) {
+			event.order_id = next_id++;
+			event.price = (kMinTick + rand() % (kMaxTick - kMinTick + 1)) / (double)kTicksPerUnit;
+			live.push_back(event.order_id);
+		} else {
+			const size_t index = rand() % live.size();
+			event.order_id = live[index];
+			event.price = 0;
+			live[index] = live.back();
+			live.pop_back();
+		}
+		events.push_back(event);
+	}
+	return events;
+}
+
+// Applies the events of one producer to the concurrent order book.
+struct Producer {
+	const StressEvent *begin;
+	const StressEvent *end;
+	ConcurrentOrderBook &order_book;
+	size_t producer;
+	size_t producer_count;
+	void operator()() const {
+		for (const StressEvent *event = begin; event != end; event++) {
+			if (static_cast<unsigned int>(event->order_id) % producer_count != producer) {
+				continue;
+			}
+			if (event->insert) {
+				order_book.insert_order(event->order_id, event->price);
+			} else {
+				order_book.erase_order(event->order_id);
+			}
+		}
+	}
+};
+
+static bool same_price(const double a, const double b) {
+	return a == b || (isnan(a) && isnan(b));
+}
+
+static bool same_book(const ConcurrentOrderBook &order_book, const OrderBook &expected) {
+	const OrderBookStats stats = expected.stats();
+	vector<PriceLevel> expected_levels(stats.price_levels + 1);
+	vector<PriceLevel> levels(order_book.level_count() + 1);
+	expected_levels.resize(expected.copy_depth(&expected_levels[0], expected_levels.size()));
+	levels.resize(order_book.copy_depth(&levels[0], levels.size()));
+	bool same = order_book.live_orders() == stats.live_orders && levels.size() == expected_levels.size() &&
+		same_price(order_book.max_price(), expected.max_price());
+	for (size_t i = 0; same && i < levels.size(); i++) {
+		same = levels[i].price == expected_levels[i].price && levels[i].count == expected_levels[i].count;
+	}
+	return same;
+}
+
+static bool replay(const vector<StressEvent> &events, const size_t phases, const size_t producer_count) {
+	ConcurrentOrderBook order_book(kTicksPerUnit, kMinTick / (double)kTicksPerUnit,
+		kMaxTick / (double)kTicksPerUnit, producer_count * 16);
+	order_book.reserve(kMaxLiveOrders / (producer_count * 16) + 1);
+	OrderBook expected;
+
+	double seconds = 0;
+	for (size_t phase = 0; phase < phases; phase++) {
+		const StressEvent *begin = &events[0] + events.size() * phase / phases;
+		const StressEvent *end = &events[0] + events.size() * (phase + 1) / phases;
+
+		const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		vector<thread> threads;
+		for (size_t i = 0; i < producer_count; i++) {
+			const Producer producer = { begin, end, order_book, i, producer_count };
+			threads.push_back(thread(producer));
+		}
+		for (size_t i = 0; i < threads.size(); i++) {
+			threads[i].join();
+		}
+		seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		for (const StressEvent *event = begin; event != end; event++) {
+			if (event->insert) {
+				expected.insert_order(event->order_id, event->price);
+			} else {
+				expected.erase_order(event->order_id);
+			}
+		}
+		if (!same_book(order_book, expected)) {
+			cerr << "ERROR: the concurrent order book differs from the sequential replay after phase "
+				 << phase << " on " << producer_count << " threads" << endl;
+			return false;
+		}
+	}
+
+	cout << events.size() << " events on " << producer_count << " threads in " << seconds << " s, "
+		 << order_book.live_orders() << " orders, max price " << order_book.max_price() << endl;
+	if (order_book.live_orders() == 0) {
+		cerr << "ERROR: the order book is empty at the end" << endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	const int event_count = argc > 1 ? atoi(argv[1]) : 1000000;
+	const size_t phases = argc > 2 ? atoi(argv[2]) : 200;
+	const vector<StressEvent> events = generate_events(max(event_count, 1));
+	const size_t producer_counts[] = { 1, 3, 8 };
+	for (size_t i = 0; i < sizeof(producer_counts) / sizeof(producer_counts[0]); i++) {
+		if (!replay(events, max(phases, (size_t)1), producer_counts[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Using Google C++ coding style
+#
+# Writes a synthetic input of order events to stdout:
+#
+#   test/gen_events.sh events [max_live_orders] [seed]
+#
+# The times increase by 0-3 milliseconds, the orders are inserted at
+# prices on a cent grid around 100, and erased in random order, with at
+# most max_live_orders orders in the book. All orders are erased at the
+# end, so the same input can be replayed with the book's capacity
+# reserved for max_live_orders.
+
+EVENTS=${1:-1000000}
+MAX_LIVE=${2:-10000}
+SEED=${3:-1}
+
+awk -v events="$EVENTS" -v max_live="$MAX_LIVE" -v seed="$SEED" 'BEGIN {
+	srand(seed)
+	time = 1000
+	live = 0
+	next_id = 1
+	for (i = 0; i < events; i++) {
+		time += int(rand() * 4)
+		if (live == 0 || (live < max_live && rand() < 0.55)) {
+			ids[live++] = next_id
+			printf "%d I %d %.2f\n", time, next_id++, 90 + int(rand() * 2000) / 100
+		} else {
+			j = int(rand() * live)
+			printf "%d E %d\n", time, ids[j]
+			ids[j] = ids[--live]
+		}
+	}
+	while (live > 0) {
+		time++
+		printf "%d E %d\n", time, ids[--live]
+	}
+}'
@@ -0,0 +1,197 @@
+// Using Google C++ coding style
+
+// Failure injection test of OrderBook: replays the same random orders
+// again and again, with the Nth allocation of each run failing with
+// bad_alloc, for each N until a run has fewer allocations (the chunks
+// which the node pools map on Linux count as allocations too). After
+// each call the book must have the same orders as the reference maps,
+// i.e. the call which has thrown must have left the book unchanged, and
+// at the end the pools must count no memory in use.
+//
+//   order_book_failures [operations]
+//
+// Prints the number of runs, and exits with 1 on the first mismatch.
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <new>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "order_book.h"
+using namespace std;
+
+// allocations made while armed, and the one which fails
+static bool armed = false;
+static long long armed_allocations = 0;
+static long long fail_allocation = 0;
+
+#ifdef __linux__
+// replaces the one of the C library for the calls of NodePool, while
+// the C library itself calls its internal one
+extern "C" void *mmap(void *address, size_t length, int protection, int flags, int fd, off_t offset) noexcept {
+	if (armed && ++armed_allocations == fail_allocation) {
+		return MAP_FAILED;
+	}
+	return reinterpret_cast<void *>(syscall(SYS_mmap, address, length, protection, flags, fd, offset));
+}
+#endif
+
+__attribute__((noinline)) void *operator new(size_t size) {
+	if (armed && ++armed_allocations == fail_allocation) {
+		throw bad_alloc();
+	}
+	void *p = malloc(size > 0 ? size : 1);
+	if (!p) {
+		throw bad_alloc();
+	}
+	return p;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept {
+	free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept {
+	free(p);
+}
+#endif
+
+// the orders expected in the book
+struct Reference {
+	map<int, double> orders;
+	map<double, int> levels;
+
+	void insert(const int order_id, const double price) {
+		if (orders.insert(make_pair(order_id, price)).second) {
+			levels[price]++;
+		}
+	}
+
+	void erase(const int order_id) {
+		const map<int, double>::iterator it = orders.find(order_id);
+		if (it != orders.end()) {
+			if (--levels[it->second] == 0) {
+				levels.erase(it->second);
+			}
+			orders.erase(it);
+		}
+	}
+};
+
+// compares the number of orders and the max price, or the whole depth
+static bool same_book(const OrderBook &book, const Reference &reference, const bool depth_check) {
+	if (book.stats().live_orders != reference.orders.size()) {
+		return false;
+	}
+	if (!depth_check) {
+		return reference.levels.empty() ? isnan(book.max_price())
+			: book.max_price() == reference.levels.rbegin()->first;
+	}
+	vector<PriceLevel> depth(reference.levels.size() + 1);
+	if (book.copy_depth(&depth[0], depth.size()) != reference.levels.size()) {
+		return false;
+	}
+	size_t i = 0;
+	for (map<double, int>::const_reverse_iterator it = reference.levels.rbegin();
+		it != reference.levels.rend(); ++it, ++i) {
+		if (depth[i].price != it->first || depth[i].count != it->second) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Returns false on a mismatch, and sets failed if the allocation has failed.
+static bool run(const int operations, bool &failed) {
+	OrderBook book;
+	Reference reference;
+	vector<int> ids;
+	srand(1);
+	failed = false;
+	armed_allocations = 0;
+	for (int i = 0; i < operations; i++) {
+		// grows to a few thousand orders, erases most of them, and
+		// compacts the book a step after each operation while it keeps
+		// changing, with the allocations of each step armed
+		const bool growing = (i / 4000) % 2 == 0;
+		const int step = rand() % 100;
+		bool thrown = false;
+		armed = true;
+		try {
+			if (i % 4000 == 2999 && !growing) {
+				book.start_compaction();
+			} else if (i % 4 == 3 && book.compacting()) {
+				book.compact(chrono::nanoseconds(0));
+			} else if (ids.empty() || (growing ? step < 70 : step < 30)) {
+				const int order_id = rand() % 100000;
+				const double price = 90 + (rand() % 3000) / 100.0;
+				book.insert_order(order_id, price);
+				armed = false;
+				reference.insert(order_id, price);
+				ids.push_back(order_id);
+			} else {
+				const size_t index = rand() % ids.size();
+				book.erase_order(ids[index]);
+				armed = false;
+				reference.erase(ids[index]);
+				ids[index] = ids.back();
+				ids.pop_back();
+			}
+		} catch (const bad_alloc &) {
+			thrown = true;
+			failed = true;
+		}
+		armed = false;
+		if (!same_book(book, reference, thrown || i % 1000 == 0)) {
+			cerr << "ERROR: the order book differs after operation " << i
+				 << " (allocation " << fail_allocation << " failed)" << endl;
+			return false;
+		}
+	}
+	for (size_t i = 0; i < ids.size(); i++) {
+		book.erase_order(ids[i]);
+		reference.erase(ids[i]);
+	}
+	const OrderBookStats stats = book.stats();
+	if (!same_book(book, reference, true) || stats.order_index.bytes > 0 || stats.price_levels_index.bytes > 0) {
+		cerr << "ERROR: the order book is not empty at the end"
+			 << " (allocation " << fail_allocation << " failed)" << endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	const int operations = argc > 1 ? atoi(argv[1]) : 20000;
+	bool failed = true;
+	for (fail_allocation = 1; failed; fail_allocation++) {
+		if (!run(operations, failed)) {
+			return 1;
+		}
+	}
+	cout << fail_allocation - 1 << " runs, allocation failed in "
+		 << fail_allocation - 2 << " of them" << endl;
+	return 0;
+}
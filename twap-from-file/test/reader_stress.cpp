@@ -0,0 +1,195 @@
+// Using Google C++ coding style
+
+// Stress test of the readers of TwapEngine: generates random order
+// events, and replays them into the engine, publishing its depth after
+// every event, while several threads read its quote (SeqLock) and depth
+// snapshots (DepthPublisher) as fast as they can. Each value read must
+// be the one after some event of a sequential replay, and never older
+// than the last one read, see StressReader.
+//
+//   reader_stress [events [readers]]
+//
+// Prints the time and the number of reads, and exits with 1 if any
+// reader has seen an inconsistent value.
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "twap_engine.h"
+using namespace std;
+
+static const size_t kDepth = 8;
+
+// orders in the book, at most
+static const size_t kMaxLiveOrders = 10000;
+
+// events with increasing times, which insert orders at prices on a cent
+// grid around 100, and erase them in random order
+static vector<OrderEvent> generate_events(const int count) {
+	vector<OrderEvent> events;
+	vector<int> live;
+	int time = 1000;
+	int next_id = 1;
+	srand(1);
+	for (int i = 0; i < count; i++) {
+		OrderEvent event;
+		time += rand() % 4;
+		event.time = time;
+		if (live.empty() || (live.size() < kMaxLiveOrders && rand() % 100 < 55)) {
+			event.operation = 'I';
+			event.order_id = next_id++;
+			event.price = 90 + rand() % 2000 / 100.0;
+			live.push_back(event.order_id);
+		} else {
+			const size_t index = rand() % live.size();
+			event.operation = 'E';
+			event.order_id = live[index];
+			event.price = 0;
+			live[index] = live.back();
+			live.pop_back();
+		}
+		events.push_back(event);
+	}
+	return events;
+}
+
+// Expected state after each event, and the reads of one reader thread.
+struct StressReader {
+	const TwapEngine &engine;
+	const vector<TwapQuote> &quotes;      // initial one, and after each event
+	const vector<PriceLevel> &levels;     // depth levels after each event
+	const vector<size_t> &level_counts;
+	const atomic<bool> &done;
+	long long quote_reads;
+	long long depth_reads;
+	string error;
+
+	static bool same_quote(const TwapQuote &a, const TwapQuote &b) {
+		return a.time == b.time &&
+			(a.max_price == b.max_price || (isnan(a.max_price) && isnan(b.max_price))) &&
+			(a.avg_price == b.avg_price || (isnan(a.avg_price) && isnan(b.avg_price)));
+	}
+
+	bool same_depth(const DepthSnapshot &snapshot) const {
+		const size_t index = snapshot.sequence - 1;
+		if (snapshot.level_count != level_counts[index]) {
+			return false;
+		}
+		for (size_t i = 0; i < snapshot.level_count; i++) {
+			const PriceLevel &level = levels[index * kDepth + i];
+			if (snapshot.levels[i].price != level.price || snapshot.levels[i].count != level.count) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// The quotes read must be the expected ones in order, i.e. not torn
+	// and never older than the last one read. The snapshots must be the
+	// expected ones in order too, and must not change while they are
+	// held, i.e. not be reused by the writer too early.
+	void operator()() {
+		size_t quote_index = 0;
+		uint64_t sequence = 0;
+		bool last_read = false;
+		while (error.empty() && !last_read) {
+			last_read = done.load();
+
+			const TwapQuote quote = engine.quote();
+			quote_reads++;
+			while (quote_index < quotes.size() && !same_quote(quotes[quote_index], quote)) {
+				quote_index++;
+			}
+			if (quote_index == quotes.size()) {
+				error = "torn or out of order quote";
+				break;
+			}
+
+			const DepthPublisher::ReadGuard guard(*engine.depth_publisher());
+			const DepthSnapshot *snapshot = guard.snapshot();
+			if (!snapshot) {
+				continue;
+			}
+			depth_reads++;
+			if (snapshot->sequence < sequence || snapshot->sequence > level_counts.size()) {
+				error = "out of order depth snapshot";
+			} else if (!same_depth(*snapshot)) {
+				error = "wrong depth snapshot";
+			} else {
+				this_thread::yield(); // let the writer publish meanwhile
+				if (!same_depth(*snapshot)) {
+					error = "depth snapshot changed while held";
+				}
+			}
+			sequence = snapshot->sequence;
+		}
+	}
+};
+
+int main(int argc, char *argv[]) {
+	const int event_count = argc > 1 ? atoi(argv[1]) : 100000;
+	const size_t reader_count = argc > 2 ? atoi(argv[2]) : 4;
+	const vector<OrderEvent> events = generate_events(event_count);
+
+	vector<TwapQuote> quotes;
+	vector<PriceLevel> levels(events.size() * kDepth);
+	vector<size_t> level_counts(events.size());
+	{
+		TwapEngine engine;
+		quotes.push_back(engine.quote());
+		for (size_t i = 0; i < events.size(); i++) {
+			engine.process(events[i]);
+			quotes.push_back(engine.quote());
+			level_counts[i] = engine.order_book().copy_depth(&levels[i * kDepth], kDepth);
+		}
+	}
+
+	TwapEngine engine;
+	engine.enable_depth(kDepth, 1);
+	atomic<bool> done(false);
+	vector<StressReader> readers;
+	for (size_t i = 0; i < reader_count; i++) {
+		const StressReader reader = { engine, quotes, levels, level_counts, done, 0, 0, string() };
+		readers.push_back(reader);
+	}
+
+	const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	vector<thread> threads;
+	for (size_t i = 0; i < readers.size(); i++) {
+		threads.push_back(thread(ref(readers[i])));
+	}
+	for (size_t i = 0; i < events.size(); i++) {
+		engine.process(events[i]);
+	}
+	done.store(true);
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+	const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	long long quote_reads = 0;
+	long long depth_reads = 0;
+	string error;
+	for (size_t i = 0; i < readers.size(); i++) {
+		quote_reads += readers[i].quote_reads;
+		depth_reads += readers[i].depth_reads;
+		if (error.empty()) {
+			error = readers[i].error;
+		}
+	}
+	cout << events.size() << " events with " << reader_count << " readers in " << seconds
+		 << " s, " << quote_reads << " quote reads, " << depth_reads << " depth reads" << endl;
+	if (!error.empty()) {
+		cerr << "ERROR: Inconsistent read: " << error << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,16 @@
+#!/bin/bash
+# Using Google C++ coding style
+#
+# Builds the library, twap-from-file and the tests with CMake, and runs
+# all the tests with ctest (see CMakeLists.txt):
+#
+#   test/run_tests.sh [build_dir]
+#
+# Exits with 1 if the build or any of the tests has failed.
+
+cd "$(dirname "$0")/.." || exit 1
+BUILD_DIR=${1:-/tmp/twap-tests}
+
+cmake -S . -B "$BUILD_DIR" || exit 1
+cmake --build "$BUILD_DIR" -j"$(nproc)" || exit 1
+ctest --test-dir "$BUILD_DIR" --output-on-failure || exit 1
@@ -0,0 +1,209 @@
+// Using Google C++ coding style
+
+// Failure injection test of the C interface: replays the same random
+// events again and again, with depth snapshots after each event and the
+// compaction on, and with the Nth allocation of each run failing with
+// bad_alloc (or the Nth chunk which a node pool maps on Linux failing),
+// for each N until a run has fewer allocations. Each event is also
+// passed to a reference engine, whose allocations don't fail, unless
+// it has returned -1, i.e. was not applied. After each event
+// both engines must have the same max price and TWAP, and the same
+// depth once published. Then the depth is enabled again with more
+// levels, with each allocation failing in turn, and the engine must
+// keep publishing with the previous levels.
+//
+//   twap_c_failures [events]
+//
+// Prints the number of runs, and exits with 1 on the first mismatch.
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "twap_c.h"
+using namespace std;
+
+// allocations made while armed, and the one which fails
+static bool armed = false;
+static long long armed_allocations = 0;
+static long long fail_allocation = 0;
+
+#ifdef __linux__
+// replaces the one of the C library for the calls of NodePool, while
+// the C library itself calls its internal one
+extern "C" void *mmap(void *address, size_t length, int protection, int flags, int fd, off_t offset) noexcept {
+	if (armed && ++armed_allocations == fail_allocation) {
+		return MAP_FAILED;
+	}
+	return reinterpret_cast<void *>(syscall(SYS_mmap, address, length, protection, flags, fd, offset));
+}
+#endif
+
+__attribute__((noinline)) void *operator new(size_t size) {
+	if (armed && ++armed_allocations == fail_allocation) {
+		throw bad_alloc();
+	}
+	void *p = malloc(size > 0 ? size : 1);
+	if (!p) {
+		throw bad_alloc();
+	}
+	return p;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept {
+	free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept {
+	free(p);
+}
+#endif
+
+static const size_t kDepth = 8;
+
+static bool same_value(const double a, const double b) {
+	return a == b || (isnan(a) && isnan(b));
+}
+
+// publishes the depth of both engines, and compares it
+static bool same_depth(twap_engine *engine, twap_engine *reference) {
+	if (twap_publish_depth(engine) != 0 || twap_publish_depth(reference) != 0) {
+		return false;
+	}
+	twap_level levels[kDepth];
+	twap_level reference_levels[kDepth];
+	int time = 0;
+	int reference_time = 0;
+	const size_t count = twap_read_depth(engine, levels, kDepth, &time);
+	if (count != twap_read_depth(reference, reference_levels, kDepth, &reference_time) ||
+		time != reference_time) {
+		return false;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (levels[i].price != reference_levels[i].price ||
+			levels[i].count != reference_levels[i].count) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Returns false on a mismatch, and sets failed if the allocation has failed.
+static bool run(const int events, bool &failed) {
+	srand(1);
+	failed = false;
+	twap_engine *engine = twap_create(0, 0);
+	twap_engine *reference = twap_create(0, 0);
+	bool same = engine && reference &&
+		twap_enable_depth(engine, kDepth, 1) == 0 && twap_enable_depth(reference, kDepth, 1) == 0;
+	if (same) {
+		twap_set_compaction_budget(engine, 1000000000);
+		twap_set_compaction_budget(reference, 1000000000);
+	}
+	vector<int> ids;
+	armed_allocations = 0;
+	for (int i = 0; same && i < events; i++) {
+		// grows to tens of thousands of orders, and erases most of them,
+		// so that the order book is compacted after the events
+		const bool growing = (i / 75000) % 2 == 0;
+		const int step = rand() % 100;
+		int result;
+		if (ids.empty() || (growing ? step < 95 : step < 5)) {
+			const int order_id = rand() % 10000000;
+			const double price = 90 + (rand() % 3000) / 100.0;
+			armed = true;
+			result = twap_insert(engine, i, order_id, price);
+			armed = false;
+			if (result != -1) {
+				same = twap_insert(reference, i, order_id, price) == result;
+				ids.push_back(order_id);
+			}
+		} else {
+			const size_t index = rand() % ids.size();
+			armed = true;
+			result = twap_erase(engine, i, ids[index]);
+			armed = false;
+			if (result != -1) {
+				same = twap_erase(reference, i, ids[index]) == result;
+				ids[index] = ids.back();
+				ids.pop_back();
+			}
+		}
+		failed |= armed_allocations >= fail_allocation;
+		same = same && same_value(twap_max_price(engine), twap_max_price(reference)) &&
+			same_value(twap_avg_price(engine), twap_avg_price(reference));
+		if (same && (result == -1 || i % 1000 == 0)) {
+			same = same_depth(engine, reference);
+		}
+		if (!same) {
+			cerr << "ERROR: the engines differ after event " << i
+				 << " (allocation " << fail_allocation << " failed)" << endl;
+		}
+	}
+	twap_destroy(engine);
+	twap_destroy(reference);
+	return same;
+}
+
+// Returns false if the depth is not published with the levels
+// of the last twap_enable_depth() which has not failed.
+static bool keeps_depth_settings() {
+	bool done = false;
+	for (fail_allocation = 1; !done; fail_allocation++) {
+		twap_engine *engine = twap_create(0, 0);
+		bool same = engine && twap_enable_depth(engine, kDepth, 1) == 0;
+		armed_allocations = 0;
+		armed = true;
+		const int result = same ? twap_enable_depth(engine, 2 * kDepth, 1) : -1;
+		armed = false;
+		const int events = 3 * kDepth;
+		for (int i = 0; same && i < events; i++) {
+			same = twap_insert(engine, i, i, 90 + i) != -1;
+		}
+		twap_level levels[2 * kDepth];
+		int time = 0;
+		same = same && twap_read_depth(engine, levels, 2 * kDepth, &time) == (result == 0 ? 2 : 1) * kDepth &&
+			time == events - 1;
+		twap_destroy(engine);
+		if (!same) {
+			cerr << "ERROR: the depth differs after enabling it again"
+				 << " (allocation " << fail_allocation << " failed)" << endl;
+			return false;
+		}
+		done = result == 0;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	const int events = argc > 1 ? atoi(argv[1]) : 150000;
+	bool failed = true;
+	for (fail_allocation = 1; failed; fail_allocation++) {
+		if (!run(events, failed)) {
+			return 1;
+		}
+	}
+	cout << fail_allocation - 1 << " runs, allocation failed in "
+		 << fail_allocation - 2 << " of them" << endl;
+	return keeps_depth_settings() ? 0 : 1;
+}